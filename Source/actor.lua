@@ -2,6 +2,8 @@ local actorList = {}
 
 local actorData = setmetatable({}, {__mode = 'k'})
 
+local actorById = {}
+
 local oldActorIndex = brute.classes.actor.__index
 
 function brute.classes.actor.__index(table, key)
@@ -47,10 +49,43 @@ function actor.spawn(map, class, x, y, angle)
     end
 
     actorList[#actorList+1] = obj
+    actorById[obj:getId()] = obj
 
     return obj
 end
 
+function actor.fromId(id)
+    return actorById[id]
+end
+
+function actor.raycast(map, x1, y1, z1, x2, y2, z2, from)
+    local hit, x, y, z, id = map:raycast(x1, y1, z1, x2, y2, z2, from)
+    if id ~= nil then
+        return hit, x, y, z, actorById[id]
+    end
+    return hit, x, y, z
+end
+
+-- The list is only valid until the next query, so copy it out now.
+local function collectIds(list)
+    local result = {}
+    for i = 1, list:count() do
+        local obj = actorById[list:get(i)]
+        if obj ~= nil then
+            result[#result+1] = obj
+        end
+    end
+    return result
+end
+
+function actor.inRadius(map, x, y, r, from)
+    return collectIds(map:actorsInRadius(x, y, r, from))
+end
+
+function actor.inBox(map, x1, y1, x2, y2, from)
+    return collectIds(map:actorsInBox(x1, y1, x2, y2, from))
+end
+
 function actor.update()
     for i = 1, #actorList do
         local obj = actorList[i]
@@ -65,6 +100,7 @@ function actor.update()
         local obj = actorList[i]
         if obj.scheduleDespawn then
             -- remove object
+            actorById[obj:getId()] = nil
             actorData[obj] = nil
             oldDespawn(obj)
         else
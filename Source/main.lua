@@ -1,6 +1,7 @@
 import "actor.lua"
 
 brute.classes.map.__gc = brute.classes.map.__index.free
+brute.classes.maploader.__gc = brute.classes.maploader.__index.free
 
 local Player = {}
 
@@ -123,7 +124,10 @@ brute.init()
 local player = actor.spawn(map, Player, 0, 0, 0)
 
 function playdate.update()
-    actor.update()
+    for _ = 1, brute.sim.update() do
+        brute.sim.tic(map)
+        actor.update()
+    end
     brute.render.draw(player)
     playdate.drawFPS(0, 0)
 end
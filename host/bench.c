@@ -0,0 +1,320 @@
+#include "host.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Turning speed of the player per tic, as in main.lua.
+#define TURNSPEED 0.05f
+
+// Walking speed of the player, as in main.lua.
+#define WALKSPEED 6.0f
+
+// Maximum number of dummy actors dropped along the path.
+#define MAXDUMMIES 16
+
+// A step of the camera path, replayed one tic per frame.
+typedef struct {
+    // Number of tics the step lasts.
+    uint16_t tics;
+    // Direction to turn in: 1 for left, -1 for right, 0 for none.
+    int8_t turn;
+    // Direction to walk in: 1 for forward, -1 for backward, 0 for none.
+    int8_t walk;
+    // If true, drop a dummy actor at the start of the step.
+    bool drop;
+} step_t;
+
+// The camera path. It looks around the starting sector, then walks through
+// the map while turning, leaving actors behind to look back at. Walls stop
+// the player as usual, so the path works on any map.
+static const step_t path[] = {
+    { 126,  1,  0, false },
+    {  40,  0,  1, true  },
+    {  30, -1,  1, false },
+    {  60,  0,  1, true  },
+    {  63,  1,  0, false },
+    {  50,  0,  1, false },
+    {  20,  1,  1, true  },
+    {  60,  0,  1, false },
+    {  63, -1,  0, false },
+    {  40,  0, -1, false },
+    {  30,  1,  1, true  },
+    {  80,  0,  1, false },
+    {  63,  1,  0, false },
+    { 120,  0,  1, false },
+};
+
+// Counters for one frame, in the order brute.render.stats returns them.
+enum {
+    STAT_SECTORS,
+    STAT_WALLS,
+    STAT_COLUMNS,
+    STAT_SPANS,
+    STAT_ACTORS,
+    NUMSTATS,
+};
+
+static const char *statnames[NUMSTATS] = {
+    "sectors",
+    "walls",
+    "columns",
+    "spans",
+    "actors",
+};
+
+// Measurements of one frame.
+typedef struct {
+    // Time to render the frame, in nanoseconds.
+    uint64_t ns;
+    // Counters of what was drawn.
+    uint32_t stats[NUMSTATS];
+} sample_t;
+
+static void Usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-d dir] [-w passes] [-r passes] [-f file] [-j threads] [-s strips] [map...]\n"
+        "Replay a camera path through each map and report the cost of rendering\n"
+        "it as one line of JSON per map.\n"
+        "  -d dir     Directory containing the converted assets folder. Default: Source\n"
+        "  -w passes  Number of untimed passes to warm caches with. Default: 1\n"
+        "  -r passes  Number of timed passes. Default: 5\n"
+        "  -f file    Also write each timed frame to a CSV file.\n"
+        "  -j threads Number of threads to render with. Default: 1\n"
+        "  -s strips  Number of strips to split the screen into. Default: 1 with one\n"
+        "             thread, otherwise 4 per thread\n"
+        "  map        Names of maps to load. Default: map01\n",
+        prog);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t Nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Get the number of frames in the camera path.
+static size_t PathLength(void) {
+    size_t frames = 0;
+    for (size_t i = 0; i < sizeof(path) / sizeof(path[0]); i++) {
+        frames += path[i].tics;
+    }
+    return frames;
+}
+
+// Free an actor spawned by the benchmark, as the Lua garbage collector would.
+static void FreeActor(LuaUDObject *actor) {
+    H_CallMethod(actor, "despawn", 0, NULL);
+    H_CallMethod(actor, "free", 0, NULL);
+}
+
+// Replay the camera path once. If samples is not NULL, time each frame.
+static void RunPath(LuaUDObject *map, sample_t *samples) {
+    // View bobbing depends on the tic, so start each pass at the same one.
+    H_Call("brute.sim.reset", 0, NULL);
+    H_CallMethod(map, "spawn", 2, (luavalue_t[]) { H_Float(0.0f), H_Float(0.0f) });
+    LuaUDObject *player = H_Result(0).o;
+    LuaUDObject *dummies[MAXDUMMIES];
+    size_t numdummies = 0;
+    float angle = 0.0f;
+    float vx = 0.0f, vy = 0.0f;
+    size_t frame = 0;
+
+    for (size_t i = 0; i < sizeof(path) / sizeof(path[0]); i++) {
+        const step_t *step = &path[i];
+        if (step->drop && numdummies < MAXDUMMIES) {
+            H_CallMethod(player, "getPos", 0, NULL);
+            luavalue_t x = H_Result(0), y = H_Result(1);
+            H_CallMethod(map, "spawn", 2, (luavalue_t[]) { x, y });
+            dummies[numdummies] = H_Result(0).o;
+            H_CallMethod(dummies[numdummies++], "setAngle", 1, (luavalue_t[]) { H_Float(angle) });
+        }
+        for (uint16_t t = 0; t < step->tics; t++) {
+            // Run a tic, moving the player as main.lua does with the D-pad.
+            H_Call("brute.sim.tic", 1, (luavalue_t[]) { H_Object(map) });
+            angle += step->turn * TURNSPEED;
+            float dx = step->walk * sinf(angle) * -WALKSPEED;
+            float dy = step->walk * cosf(angle) * WALKSPEED;
+            vx = (vx + dx * 0.25f) * 0.8f;
+            vy = (vy + dy * 0.25f) * 0.8f;
+            H_CallMethod(player, "setAngle", 1, (luavalue_t[]) { H_Float(angle) });
+            H_CallMethod(player, "setVel", 2, (luavalue_t[]) { H_Float(vx), H_Float(vy) });
+            H_CallMethod(player, "applyVelocity", 0, NULL);
+            H_CallMethod(player, "applyGravity", 0, NULL);
+            // Draw the frame.
+            uint64_t start = Nanoseconds();
+            H_Call("brute.render.draw", 1, (luavalue_t[]) { H_Object(player) });
+            uint64_t end = Nanoseconds();
+            if (samples != NULL) {
+                sample_t *sample = &samples[frame];
+                sample->ns = end - start;
+                H_Call("brute.render.stats", 0, NULL);
+                for (int s = 0; s < NUMSTATS; s++) {
+                    sample->stats[s] = H_Result(s).i;
+                }
+            }
+            ++frame;
+        }
+    }
+
+    for (size_t i = 0; i < numdummies; i++) {
+        FreeActor(dummies[i]);
+    }
+    FreeActor(player);
+}
+
+static int CompareTimes(const void *p, const void *q) {
+    uint64_t a = *(const uint64_t *) p;
+    uint64_t b = *(const uint64_t *) q;
+    return (a > b) - (a < b);
+}
+
+// Get a percentile of sorted times, in microseconds, by nearest rank.
+static double Percentile(const uint64_t *sorted, size_t count, double pct) {
+    size_t rank = (size_t) ceil(pct / 100.0 * count);
+    if (rank > 0) {
+        --rank;
+    }
+    return sorted[rank] / 1000.0;
+}
+
+// Get the number of textures made resident so far.
+static int TextureLoads(void) {
+    H_Call("brute.textures.stats", 0, NULL);
+    return H_Result(5).i;
+}
+
+static void Report(const char *mapname, const sample_t *samples, size_t count, int passes, int loads) {
+    uint64_t *times = malloc(sizeof(uint64_t) * count);
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        times[i] = samples[i].ns;
+        total += samples[i].ns;
+    }
+    qsort(times, count, sizeof(uint64_t), CompareTimes);
+
+    printf("{\"map\":\"%s\",\"frames\":%zu,\"passes\":%d,", mapname, count / passes, passes);
+    printf("\"time_us\":{\"mean\":%.2f,\"min\":%.2f,\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"max\":%.2f},",
+        total / 1000.0 / count,
+        times[0] / 1000.0,
+        Percentile(times, count, 50.0),
+        Percentile(times, count, 90.0),
+        Percentile(times, count, 99.0),
+        times[count - 1] / 1000.0);
+    // Counters are the same in every pass, so only look at the first.
+    size_t frames = count / passes;
+    for (int s = 0; s < NUMSTATS; s++) {
+        uint64_t sum = 0;
+        uint32_t max = 0;
+        for (size_t i = 0; i < frames; i++) {
+            sum += samples[i].stats[s];
+            if (samples[i].stats[s] > max) {
+                max = samples[i].stats[s];
+            }
+        }
+        printf("\"%s\":{\"total\":%llu,\"mean\":%.2f,\"max\":%u},",
+            statnames[s], (unsigned long long) sum, (double) sum / frames, max);
+    }
+    // Loading textures while timing makes frames slower, so report it.
+    printf("\"texture_loads\":%d}\n", loads);
+    fflush(stdout);
+    free(times);
+}
+
+int main(int argc, char **argv) {
+    const char *root = "Source";
+    const char *csvpath = NULL;
+    int warmup = 1;
+    int passes = 5;
+    int threads = 1;
+    int strips = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:r:f:j:s:h")) != -1) {
+        switch (opt) {
+            case 'd':
+                root = optarg;
+                break;
+            case 'w':
+                warmup = atoi(optarg);
+                break;
+            case 'r':
+                passes = atoi(optarg);
+                break;
+            case 'f':
+                csvpath = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 's':
+                strips = atoi(optarg);
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+    if (warmup < 0 || passes < 1 || threads < 1 || strips < 0) {
+        Usage(argv[0]);
+    }
+    static const char *defaultmaps[] = { "map01" };
+    const char **maps = optind < argc ? (const char **) &argv[optind] : defaultmaps;
+    int nummaps = optind < argc ? argc - optind : 1;
+
+    FILE *csv = NULL;
+    if (csvpath != NULL) {
+        csv = fopen(csvpath, "w");
+        if (csv == NULL) {
+            fprintf(stderr, "error: could not open %s\n", csvpath);
+            return EXIT_FAILURE;
+        }
+        fprintf(csv, "map,pass,frame,time_us");
+        for (int s = 0; s < NUMSTATS; s++) {
+            fprintf(csv, ",%s", statnames[s]);
+        }
+        fprintf(csv, "\n");
+    }
+
+    H_Init(root);
+    // The path is replayed tic by tic, so keep the clock still.
+    H_UseFixedClock();
+    H_Call("brute.init", 0, NULL);
+    H_SetRenderThreads(threads, strips);
+
+    size_t frames = PathLength();
+    sample_t *samples = malloc(sizeof(sample_t) * frames * passes);
+    for (int m = 0; m < nummaps; m++) {
+        H_Call("brute.map.load", 1, (luavalue_t[]) { H_String(maps[m]) });
+        LuaUDObject *map = H_Result(0).o;
+        for (int i = 0; i < warmup; i++) {
+            RunPath(map, NULL);
+        }
+        int loads = TextureLoads();
+        for (int i = 0; i < passes; i++) {
+            RunPath(map, &samples[frames * i]);
+        }
+        loads = TextureLoads() - loads;
+        Report(maps[m], samples, frames * passes, passes, loads);
+        if (csv != NULL) {
+            for (size_t i = 0; i < frames * passes; i++) {
+                fprintf(csv, "%s,%zu,%zu,%.2f", maps[m], i / frames, i % frames, samples[i].ns / 1000.0);
+                for (int s = 0; s < NUMSTATS; s++) {
+                    fprintf(csv, ",%u", samples[i].stats[s]);
+                }
+                fprintf(csv, "\n");
+            }
+        }
+        H_CallMethod(map, "free", 0, NULL);
+    }
+    free(samples);
+
+    if (csv != NULL) {
+        fclose(csv);
+    }
+    H_Call("brute.quit", 0, NULL);
+    H_Quit();
+    return EXIT_SUCCESS;
+}
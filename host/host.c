@@ -0,0 +1,536 @@
+#define _GNU_SOURCE
+
+#include "host.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// The engine's entry point.
+int eventHandler(PlaydateAPI *pd, PDSystemEvent event, uint32_t arg);
+
+// Maximum number of functions, including methods, the engine can register.
+#define MAXFUNCTIONS 128
+
+// Maximum length of a path.
+#define MAXPATH 1024
+
+struct LuaUDObject {
+    // The wrapped pointer.
+    void *ptr;
+    // The class name.
+    const char *type;
+    // The next object, so they can be freed.
+    struct LuaUDObject *next;
+};
+
+struct SDFile {
+    FILE *fp;
+};
+
+// A registered function. Methods are named "class:method".
+typedef struct {
+    char *name;
+    lua_CFunction func;
+} function_t;
+
+static function_t functions[MAXFUNCTIONS];
+static size_t numfunctions = 0;
+
+// Arguments and results of the current call.
+static const luavalue_t *callargs;
+static int numcallargs;
+static luavalue_t results[H_MAXVALUES];
+static int numresults;
+
+// All objects pushed so far.
+static LuaUDObject *objects = NULL;
+
+// Directory that paths are relative to.
+static const char *rootdir = ".";
+
+// The framebuffer.
+static uint8_t framebuffer[LCD_ROWSIZE * LCD_ROWS];
+static uint32_t flushcount = 0;
+
+// The clock.
+static bool fixedclock = false;
+static unsigned int fixedtime = 0;
+
+// Report an error and exit, as the Playdate stops on errors.
+static void Sys_Error(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fputs("error: ", stderr);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+static void GetPath(char *buf, const char *path) {
+    if ((size_t) snprintf(buf, MAXPATH, "%s/%s", rootdir, path) >= MAXPATH) {
+        Sys_Error("path too long: %s", path);
+    }
+}
+
+// System functions.
+
+static void *Sys_Realloc(void *ptr, size_t size) {
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    void *result = realloc(ptr, size);
+    if (result == NULL) {
+        Sys_Error("out of memory");
+    }
+    return result;
+}
+
+static int Sys_FormatString(char **ret, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = vasprintf(ret, fmt, args);
+    va_end(args);
+    if (result < 0) {
+        Sys_Error("out of memory");
+    }
+    return result;
+}
+
+static void Sys_LogToConsole(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+static unsigned int Sys_GetCurrentTimeMilliseconds(void) {
+    if (fixedclock) {
+        return fixedtime;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000u + ts.tv_nsec / 1000000u;
+}
+
+// Time the elapsed time is measured from, in seconds.
+static double elapsedstart;
+
+static double MonotonicSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static float Sys_GetElapsedTime(void) {
+    return MonotonicSeconds() - elapsedstart;
+}
+
+static void Sys_ResetElapsedTime(void) {
+    elapsedstart = MonotonicSeconds();
+}
+
+static const struct playdate_sys hostsys = {
+    .realloc = Sys_Realloc,
+    .formatString = Sys_FormatString,
+    .logToConsole = Sys_LogToConsole,
+    .error = Sys_Error,
+    .getCurrentTimeMilliseconds = Sys_GetCurrentTimeMilliseconds,
+    .getElapsedTime = Sys_GetElapsedTime,
+    .resetElapsedTime = Sys_ResetElapsedTime,
+};
+
+// File functions.
+
+static int File_Listfiles(
+    const char *path,
+    void (*callback)(const char *path, void *userdata),
+    void *userdata,
+    int showhidden
+) {
+    char full[MAXPATH];
+    GetPath(full, path);
+    DIR *dir = opendir(full);
+    if (dir == NULL) {
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (!showhidden && entry->d_name[0] == '.') {
+            continue;
+        }
+        // Directories are listed with a trailing slash.
+        char entrypath[MAXPATH + sizeof(entry->d_name) + 1];
+        snprintf(entrypath, sizeof(entrypath), "%s/%s", full, entry->d_name);
+        struct stat st;
+        if (stat(entrypath, &st) == 0 && S_ISDIR(st.st_mode)) {
+            char name[MAXPATH];
+            snprintf(name, sizeof(name), "%s/", entry->d_name);
+            callback(name, userdata);
+        } else {
+            callback(entry->d_name, userdata);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int File_Stat(const char *path, FileStat *result) {
+    char full[MAXPATH];
+    GetPath(full, path);
+    struct stat st;
+    if (stat(full, &st) != 0) {
+        return -1;
+    }
+    memset(result, 0, sizeof(FileStat));
+    result->isdir = S_ISDIR(st.st_mode);
+    result->size = st.st_size;
+    return 0;
+}
+
+static SDFile *File_Open(const char *name, FileOptions mode) {
+    if (mode & (kFileWrite | kFileAppend)) {
+        // The engine only reads.
+        return NULL;
+    }
+    char full[MAXPATH];
+    GetPath(full, name);
+    FILE *fp = fopen(full, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+    SDFile *file = Sys_Realloc(NULL, sizeof(SDFile));
+    file->fp = fp;
+    return file;
+}
+
+static int File_Close(SDFile *file) {
+    int result = fclose(file->fp);
+    free(file);
+    return result == 0 ? 0 : -1;
+}
+
+static int File_Read(SDFile *file, void *buf, unsigned int len) {
+    size_t result = fread(buf, 1, len, file->fp);
+    if (result < len && ferror(file->fp)) {
+        return -1;
+    }
+    return result;
+}
+
+static const struct playdate_file hostfile = {
+    .listfiles = File_Listfiles,
+    .stat = File_Stat,
+    .open = File_Open,
+    .close = File_Close,
+    .read = File_Read,
+};
+
+// Graphics functions.
+
+static uint8_t *Gfx_GetFrame(void) {
+    return framebuffer;
+}
+
+static void Gfx_MarkUpdatedRows(int start, int end) {
+    ++flushcount;
+}
+
+static const struct playdate_graphics hostgraphics = {
+    .getFrame = Gfx_GetFrame,
+    .markUpdatedRows = Gfx_MarkUpdatedRows,
+};
+
+// Lua functions.
+
+static void AddFunction(const char *name, lua_CFunction func) {
+    if (numfunctions == MAXFUNCTIONS) {
+        Sys_Error("too many functions registered");
+    }
+    function_t *function = &functions[numfunctions++];
+    function->name = strdup(name);
+    function->func = func;
+}
+
+static lua_CFunction FindFunction(const char *name) {
+    for (size_t i = 0; i < numfunctions; i++) {
+        if (strcmp(functions[i].name, name) == 0) {
+            return functions[i].func;
+        }
+    }
+    Sys_Error("no function named %s", name);
+    return NULL;
+}
+
+static const luavalue_t *GetArg(int pos) {
+    static const luavalue_t nil = { .type = LV_NIL };
+    if (pos < 1 || pos > numcallargs) {
+        return &nil;
+    }
+    return &callargs[pos - 1];
+}
+
+static void PushResult(luavalue_t value) {
+    if (numresults == H_MAXVALUES) {
+        Sys_Error("too many results");
+    }
+    results[numresults++] = value;
+}
+
+static int Lua_AddFunction(lua_CFunction f, const char *name, const char **outErr) {
+    AddFunction(name, f);
+    return 1;
+}
+
+static int Lua_RegisterClass(
+    const char *name,
+    const lua_reg *reg,
+    const lua_val *vals,
+    int isstatic,
+    const char **outErr
+) {
+    for (; reg->name != NULL; reg++) {
+        char method[MAXPATH];
+        snprintf(method, sizeof(method), "%s:%s", name, reg->name);
+        AddFunction(method, reg->func);
+    }
+    return 1;
+}
+
+static int Lua_GetArgCount(void) {
+    return numcallargs;
+}
+
+static int Lua_ArgIsNil(int pos) {
+    return GetArg(pos)->type == LV_NIL;
+}
+
+static int Lua_GetArgBool(int pos) {
+    const luavalue_t *arg = GetArg(pos);
+    return arg->type == LV_BOOL ? arg->i : arg->type != LV_NIL;
+}
+
+static int Lua_GetArgInt(int pos) {
+    const luavalue_t *arg = GetArg(pos);
+    if (arg->type == LV_FLOAT) {
+        return (int) arg->f;
+    }
+    return arg->type == LV_INT ? arg->i : 0;
+}
+
+static float Lua_GetArgFloat(int pos) {
+    const luavalue_t *arg = GetArg(pos);
+    if (arg->type == LV_INT) {
+        return (float) arg->i;
+    }
+    return arg->type == LV_FLOAT ? arg->f : 0.0f;
+}
+
+static const char *Lua_GetArgString(int pos) {
+    const luavalue_t *arg = GetArg(pos);
+    return arg->type == LV_STRING ? arg->s : NULL;
+}
+
+static void *Lua_GetArgObject(int pos, char *type, LuaUDObject **outud) {
+    const luavalue_t *arg = GetArg(pos);
+    if (arg->type != LV_OBJECT || strcmp(arg->o->type, type) != 0) {
+        return NULL;
+    }
+    if (outud != NULL) {
+        *outud = arg->o;
+    }
+    return arg->o->ptr;
+}
+
+static void Lua_PushNil(void) {
+    PushResult(H_Nil());
+}
+
+static void Lua_PushBool(int val) {
+    PushResult(H_Bool(val));
+}
+
+static void Lua_PushInt(int val) {
+    PushResult(H_Int(val));
+}
+
+static void Lua_PushFloat(float val) {
+    PushResult(H_Float(val));
+}
+
+static void Lua_PushString(const char *str) {
+    // Strings are kept alive with the objects.
+    LuaUDObject *obj = Sys_Realloc(NULL, sizeof(LuaUDObject));
+    obj->ptr = strdup(str);
+    obj->type = NULL;
+    obj->next = objects;
+    objects = obj;
+    PushResult(H_String(obj->ptr));
+}
+
+static LuaUDObject *Lua_PushObject(void *ptr, char *type, int nValues) {
+    LuaUDObject *obj = Sys_Realloc(NULL, sizeof(LuaUDObject));
+    obj->ptr = ptr;
+    obj->type = type;
+    obj->next = objects;
+    objects = obj;
+    PushResult(H_Object(obj));
+    return obj;
+}
+
+static const struct playdate_lua hostlua = {
+    .addFunction = Lua_AddFunction,
+    .registerClass = Lua_RegisterClass,
+    .getArgCount = Lua_GetArgCount,
+    .argIsNil = Lua_ArgIsNil,
+    .getArgBool = Lua_GetArgBool,
+    .getArgInt = Lua_GetArgInt,
+    .getArgFloat = Lua_GetArgFloat,
+    .getArgString = Lua_GetArgString,
+    .getArgObject = Lua_GetArgObject,
+    .pushNil = Lua_PushNil,
+    .pushBool = Lua_PushBool,
+    .pushInt = Lua_PushInt,
+    .pushFloat = Lua_PushFloat,
+    .pushString = Lua_PushString,
+    .pushObject = Lua_PushObject,
+};
+
+static PlaydateAPI hostapi = {
+    .system = &hostsys,
+    .file = &hostfile,
+    .graphics = &hostgraphics,
+    .lua = &hostlua,
+};
+
+void H_Init(const char *root) {
+    rootdir = root;
+    Sys_ResetElapsedTime();
+    eventHandler(&hostapi, kEventInitLua, 0);
+}
+
+void H_Quit(void) {
+    while (objects != NULL) {
+        LuaUDObject *next = objects->next;
+        if (objects->type == NULL) {
+            // A string.
+            free(objects->ptr);
+        }
+        free(objects);
+        objects = next;
+    }
+    for (size_t i = 0; i < numfunctions; i++) {
+        free(functions[i].name);
+    }
+    numfunctions = 0;
+}
+
+int H_Call(const char *name, int nargs, const luavalue_t *args) {
+    lua_CFunction func = FindFunction(name);
+    callargs = args;
+    numcallargs = nargs;
+    numresults = 0;
+    int result = func(NULL);
+    callargs = NULL;
+    numcallargs = 0;
+    return result;
+}
+
+int H_CallMethod(LuaUDObject *self, const char *method, int nargs, const luavalue_t *args) {
+    char name[MAXPATH];
+    snprintf(name, sizeof(name), "%s:%s", self->type, method);
+    luavalue_t selfargs[H_MAXVALUES];
+    if (nargs + 1 > H_MAXVALUES) {
+        Sys_Error("too many arguments");
+    }
+    selfargs[0] = H_Object(self);
+    for (int i = 0; i < nargs; i++) {
+        selfargs[i + 1] = args[i];
+    }
+    return H_Call(name, nargs + 1, selfargs);
+}
+
+luavalue_t H_Result(int index) {
+    if (index < 0 || index >= numresults) {
+        return H_Nil();
+    }
+    return results[index];
+}
+
+void *H_ObjectPointer(const LuaUDObject *obj) {
+    return obj->ptr;
+}
+
+luavalue_t H_Nil(void) {
+    return (luavalue_t) { .type = LV_NIL };
+}
+
+luavalue_t H_Bool(bool b) {
+    return (luavalue_t) { .type = LV_BOOL, .i = b };
+}
+
+luavalue_t H_Int(int i) {
+    return (luavalue_t) { .type = LV_INT, .i = i };
+}
+
+luavalue_t H_Float(float f) {
+    return (luavalue_t) { .type = LV_FLOAT, .f = f };
+}
+
+luavalue_t H_String(const char *s) {
+    return (luavalue_t) { .type = LV_STRING, .s = s };
+}
+
+luavalue_t H_Object(LuaUDObject *o) {
+    return (luavalue_t) { .type = LV_OBJECT, .o = o };
+}
+
+void H_UseFixedClock(void) {
+    fixedclock = true;
+}
+
+void H_AdvanceTime(unsigned int ms) {
+    fixedtime += ms;
+}
+
+void H_SetRenderThreads(int threads, int strips) {
+    if (strips == 0) {
+        strips = threads > 1 ? threads * 4 : 1;
+    }
+    H_Call("brute.render.threads", 1, (luavalue_t[]) { H_Int(threads) });
+    H_Call("brute.render.strips", 1, (luavalue_t[]) { H_Int(strips) });
+}
+
+const uint8_t *H_GetFrame(void) {
+    return framebuffer;
+}
+
+uint32_t H_GetFlushCount(void) {
+    return flushcount;
+}
+
+bool H_WritePBM(const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "P4\n%d %d\n", LCD_COLUMNS, LCD_ROWS);
+    // PBM uses 1 for black, while the Playdate uses 1 for white.
+    uint8_t row[LCD_COLUMNS / 8];
+    for (int y = 0; y < LCD_ROWS; y++) {
+        for (int x = 0; x < LCD_COLUMNS / 8; x++) {
+            row[x] = ~framebuffer[LCD_ROWSIZE * y + x];
+        }
+        fwrite(row, 1, sizeof(row), fp);
+    }
+    return fclose(fp) == 0;
+}
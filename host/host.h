@@ -0,0 +1,89 @@
+#ifndef BRUTE_H_HOST_H
+#define BRUTE_H_HOST_H
+
+/**
+ * Host platform layer. Implements the parts of the Playdate API the engine
+ * uses on top of the C library, and stands in for the Lua runtime so that
+ * host programs can call the functions the engine registers with Lua.
+ */
+
+#include <pd_api.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Types of Lua values.
+typedef enum {
+    LV_NIL,
+    LV_BOOL,
+    LV_INT,
+    LV_FLOAT,
+    LV_STRING,
+    LV_OBJECT,
+} luatype_t;
+
+// A Lua value passed to or returned from an engine function.
+typedef struct {
+    // The type of the value.
+    luatype_t type;
+    // The value itself, depending on type.
+    union {
+        int i;
+        float f;
+        const char *s;
+        LuaUDObject *o;
+    };
+} luavalue_t;
+
+// Maximum number of arguments or results of a call.
+#define H_MAXVALUES 16
+
+// Initialize the host layer, loading assets relative to the given directory,
+// and have the engine register its functions.
+void H_Init(const char *root);
+
+// Free everything the host layer allocated.
+void H_Quit(void);
+
+// Call a global function by its Lua name, such as "brute.map.load". Returns
+// the number of results.
+int H_Call(const char *name, int nargs, const luavalue_t *args);
+
+// Call a method of an object, passing the object as the first argument.
+// Returns the number of results.
+int H_CallMethod(LuaUDObject *self, const char *method, int nargs, const luavalue_t *args);
+
+// Get a result of the last call, starting at 0.
+luavalue_t H_Result(int index);
+
+// Get the pointer wrapped by an object.
+void *H_ObjectPointer(const LuaUDObject *obj);
+
+// Helpers to make Lua values.
+luavalue_t H_Nil(void);
+luavalue_t H_Bool(bool b);
+luavalue_t H_Int(int i);
+luavalue_t H_Float(float f);
+luavalue_t H_String(const char *s);
+luavalue_t H_Object(LuaUDObject *o);
+
+// Use a fixed clock that only moves with H_AdvanceTime, for deterministic runs.
+void H_UseFixedClock(void);
+
+// Advance the fixed clock by some milliseconds.
+void H_AdvanceTime(unsigned int ms);
+
+// Set the number of render threads and strips. If strips is 0, use 1 strip
+// with one thread, and 4 per thread otherwise. Call after brute.init.
+void H_SetRenderThreads(int threads, int strips);
+
+// Get the framebuffer.
+const uint8_t *H_GetFrame(void);
+
+// Get the number of times rows were marked as updated.
+uint32_t H_GetFlushCount(void);
+
+// Write the framebuffer to a binary PBM file. Returns false on failure.
+bool H_WritePBM(const char *path);
+
+#endif
@@ -0,0 +1,342 @@
+#include "host.h"
+#include "system.h"
+#include "video.h"
+#include "map/defs.h"
+#include "render/draw.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Number of bytes in a framebuffer row.
+#define ROWSTRIDE LCD_ROWSIZE
+
+// Number of bytes in the framebuffer.
+#define FRAMEBYTES (ROWSTRIDE * LCD_ROWS)
+
+// Size of the random texture data kernels read from. Large enough for
+// sprite columns, which are not wrapped.
+#define SOURCEBYTES 16384
+
+// Largest texture height used for walls.
+#define MAXPATCHHEIGHTBITS 7
+
+// Width and height of a flat.
+#define FLATWIDTH 64
+
+extern uint8_t detaillevel;
+
+// A kernel to check and measure.
+typedef struct {
+    // Name of the kernel.
+    const char *name;
+    // Set random parameters.
+    void (*randomize)(void);
+    // Run the kernel.
+    void (*kernel)(void);
+    // Run the reference implementation on a framebuffer.
+    void (*reference)(uint8_t *framebuffer);
+    // Get the number of pixels the parameters cover.
+    uint32_t (*pixels)(void);
+    // If true, the kernel does not depend on the detail level.
+    bool anydetail;
+} kernel_t;
+
+static uint32_t rngstate;
+
+static uint8_t source[SOURCEBYTES];
+
+static uint32_t Random(void) {
+    // xorshift32.
+    uint32_t x = rngstate;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rngstate = x;
+    return x;
+}
+
+// Get a random number from min to max, inclusive.
+static int32_t RandomRange(int32_t min, int32_t max) {
+    return min + (int32_t) (Random() % (uint32_t) (max - min + 1));
+}
+
+static void RandomBytes(uint8_t *buf, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = Random();
+    }
+}
+
+static uint8_t GetTexel(const uint8_t *data, uint32_t index) {
+    return (data[index >> 1] >> ((index & 1) << 2)) & 15;
+}
+
+static void SetPixel(uint8_t *framebuffer, uint16_t x, uint8_t y, uint8_t bit) {
+    uint8_t *byte = &framebuffer[(x >> 3) + ROWSTRIDE * y];
+    uint8_t mask = 0x80 >> (x & 7);
+    *byte = bit ? (*byte | mask) : (*byte & ~mask);
+}
+
+static uint8_t GetPixel(const uint8_t *framebuffer, uint16_t x, uint8_t y) {
+    return (framebuffer[(x >> 3) + ROWSTRIDE * y] >> (7 - (x & 7))) & 1;
+}
+
+// Plot a shade at a pixel, or at two pixels at low detail.
+static void PlotShade(uint8_t *framebuffer, uint16_t x, uint8_t y, const uint8_t *shade) {
+    uint8_t pattern = shade[y & 3];
+    SetPixel(framebuffer, x, y, (pattern >> (7 - (x & 7))) & 1);
+    if (detaillevel) {
+        SetPixel(framebuffer, x + 1, y, (pattern >> (6 - (x & 7))) & 1);
+    }
+}
+
+// R_DrawColumn.
+
+static drawcolumn_t dc;
+
+static void RandomColumn(void) {
+    dc.source = source;
+    dc.shades = R_ShadeTable(Random(), RandomRange(0, 4095), RandomRange(0, NUMSHADES - 1));
+    // Walls wrap their textures, but sprites do not.
+    dc.height = Random() % 8 ? 1 << RandomRange(0, MAXPATCHHEIGHTBITS) : 0x8000;
+    dc.scale = RandomRange(1 << 6, 1 << 15);
+    dc.offset = RandomRange(-(1 << 24), 1 << 24);
+    dc.x = RandomRange(0, SCREENWIDTH - 1);
+    dc.yh = RandomRange(0, SCREENHEIGHT - 1);
+    dc.yl = RandomRange(dc.yh, SCREENHEIGHT);
+}
+
+static void RunColumn(void) {
+    R_DrawColumn(&dc);
+}
+
+static void RefColumn(uint8_t *framebuffer) {
+    if (detaillevel && (dc.x & 1)) {
+        return;
+    }
+    // Texture coordinates wrap at the height.
+    uint32_t wrap = ((uint32_t) dc.height << FRACBITS) - 1;
+    for (int y = dc.yh; y < dc.yl; y++) {
+        uint32_t frac = (uint32_t) (dc.scale * (y - (SCREENHEIGHT >> 1)) + dc.offset) & wrap;
+        uint8_t texel = GetTexel(dc.source, frac >> FRACBITS);
+        PlotShade(framebuffer, dc.x, y, (*dc.shades)[texel]);
+    }
+}
+
+static uint32_t ColumnPixels(void) {
+    if (!detaillevel) {
+        return dc.yl - dc.yh;
+    }
+    return dc.x & 1 ? 0 : (dc.yl - dc.yh) * 2;
+}
+
+// R_DrawSpan.
+
+static drawspan_t ds;
+
+static void RandomSpan(void) {
+    ds.source = source;
+    ds.shades = R_ShadeTable(Random(), RandomRange(0, 4095), RandomRange(0, NUMSHADES - 1));
+    ds.xstep = RandomRange(-(4 << FRACBITS), 4 << FRACBITS);
+    ds.ystep = RandomRange(-(4 << FRACBITS), 4 << FRACBITS);
+    ds.xfrac = Random();
+    ds.yfrac = Random();
+    ds.x1 = RandomRange(0, SCREENWIDTH);
+    ds.x2 = RandomRange(ds.x1, SCREENWIDTH);
+    ds.y = RandomRange(0, SCREENHEIGHT - 1);
+}
+
+static void RunSpan(void) {
+    R_DrawSpan(&ds);
+}
+
+static void RefSpan(uint8_t *framebuffer) {
+    uint16_t x1 = ds.x1, x2 = ds.x2;
+    fixed_t xstep = ds.xstep, ystep = ds.ystep;
+    uint16_t step = 1;
+    // At low detail, pairs are textured as their left pixel.
+    fixed_t xfrac = ds.xfrac, yfrac = ds.yfrac;
+    if (detaillevel) {
+        xfrac -= xstep * (x1 & 1);
+        yfrac -= ystep * (x1 & 1);
+        x1 &= ~1;
+        x2 &= ~1;
+        xstep *= 2;
+        ystep *= 2;
+        step = 2;
+    }
+    // Flats wrap every FLATWIDTH texels in both directions.
+    uint32_t wrap = (FLATWIDTH << FRACBITS) - 1;
+    for (uint32_t i = 0; x1 + i * step < x2; i++) {
+        uint32_t fx = (uint32_t) (xfrac + xstep * (int32_t) i) & wrap;
+        uint32_t fy = (uint32_t) (yfrac + ystep * (int32_t) i) & wrap;
+        uint32_t index = (fx >> FRACBITS) + (fy >> FRACBITS) * FLATWIDTH;
+        uint8_t texel = GetTexel(ds.source, index);
+        PlotShade(framebuffer, x1 + i * step, ds.y, (*ds.shades)[texel]);
+    }
+}
+
+static uint32_t SpanPixels(void) {
+    if (!detaillevel) {
+        return ds.x2 - ds.x1;
+    }
+    return (ds.x2 & ~1) - (ds.x1 & ~1);
+}
+
+// R_Blit.
+
+static drawblit_t blit;
+
+static void RandomBlit(void) {
+    blit.source = source;
+    blit.x = RandomRange(0, SCREENWIDTH - 8);
+    int32_t maxlength = (SCREENWIDTH - blit.x) / 8;
+    blit.length = RandomRange(1, maxlength > 255 ? 255 : maxlength);
+    blit.y = RandomRange(0, SCREENHEIGHT - 1);
+}
+
+static void RunBlit(void) {
+    R_Blit(&blit);
+}
+
+static void RefBlit(uint8_t *framebuffer) {
+    // Each byte of bits follows a byte of mask, where set bits keep the
+    // pixel underneath before the bits are drawn over it.
+    for (uint32_t i = 0; i < blit.length * 8u; i++) {
+        uint8_t mask = (blit.source[(i >> 3) * 2] >> (7 - (i & 7))) & 1;
+        uint8_t bits = (blit.source[(i >> 3) * 2 + 1] >> (7 - (i & 7))) & 1;
+        uint16_t x = blit.x + i;
+        SetPixel(framebuffer, x, blit.y, (GetPixel(framebuffer, x, blit.y) & mask) | bits);
+    }
+}
+
+static uint32_t BlitPixels(void) {
+    return blit.length * 8u;
+}
+
+static const kernel_t kernels[] = {
+    { "R_DrawColumn", RandomColumn, RunColumn, RefColumn, ColumnPixels, false },
+    { "R_DrawSpan",   RandomSpan,   RunSpan,   RefSpan,   SpanPixels,   false },
+    { "R_Blit",       RandomBlit,   RunBlit,   RefBlit,   BlitPixels,   true  },
+};
+
+#define NUMKERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static uint64_t Nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Check a kernel against its reference. Returns the number of mismatches.
+static uint32_t Check(const kernel_t *k, uint8_t *framebuffer, uint32_t count) {
+    static uint8_t expected[FRAMEBYTES];
+    uint32_t mismatches = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        RandomBytes(framebuffer, FRAMEBYTES);
+        RandomBytes(source, SOURCEBYTES);
+        k->randomize();
+        memcpy(expected, framebuffer, FRAMEBYTES);
+        k->reference(expected);
+        k->kernel();
+        if (memcmp(expected, framebuffer, FRAMEBYTES) != 0) {
+            if (mismatches == 0) {
+                size_t at = 0;
+                while (expected[at] == framebuffer[at]) {
+                    ++at;
+                }
+                fprintf(stderr, "%s: mismatch in set %u at x=%zu y=%zu: expected %02x, got %02x\n",
+                    k->name, i, (at % ROWSTRIDE) * 8, at / ROWSTRIDE, expected[at], framebuffer[at]);
+            }
+            ++mismatches;
+        }
+    }
+    return mismatches;
+}
+
+// Measure a kernel over random parameter sets. Returns pixels per second.
+static double Measure(const kernel_t *k, uint32_t count) {
+    // Time the kernel with the parameters, then take away the time of making
+    // the parameters alone.
+    uint32_t state = rngstate;
+    uint64_t start = Nanoseconds();
+    for (uint32_t i = 0; i < count; i++) {
+        k->randomize();
+        k->kernel();
+    }
+    uint64_t kernelns = Nanoseconds() - start;
+    rngstate = state;
+    uint64_t pixels = 0;
+    start = Nanoseconds();
+    for (uint32_t i = 0; i < count; i++) {
+        k->randomize();
+        pixels += k->pixels();
+    }
+    uint64_t randomns = Nanoseconds() - start;
+    return kernelns > randomns ? pixels * 1e9 / (kernelns - randomns) : 0.0;
+}
+
+static void Usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [-s seed] [-c sets] [-m sets]\n"
+        "Check the draw kernels byte for byte against reference implementations\n"
+        "on random parameters, and measure their speed. Prints one line of JSON\n"
+        "per kernel and detail level, and fails if any output differs.\n"
+        "  -s seed  Seed of the random parameters. Default: 1\n"
+        "  -c sets  Number of parameter sets to check. Default: 20000\n"
+        "  -m sets  Number of parameter sets to measure. Default: 1000000\n",
+        prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    uint32_t seed = 1;
+    uint32_t checks = 20000;
+    uint32_t measures = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:m:h")) != -1) {
+        switch (opt) {
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'c':
+                checks = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                measures = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+    if (seed == 0 || optind != argc) {
+        Usage(argv[0]);
+    }
+
+    H_Init(".");
+    R_InitLighting();
+    R_LoadFramebuffer();
+    uint8_t *framebuffer = playdate->graphics->getFrame();
+
+    bool failed = false;
+    for (size_t i = 0; i < NUMKERNELS; i++) {
+        const kernel_t *k = &kernels[i];
+        for (detaillevel = 0; detaillevel < 2; detaillevel++) {
+            // Every kernel sees the same parameters for a seed.
+            rngstate = seed;
+            uint32_t mismatches = Check(k, framebuffer, checks);
+            double rate = Measure(k, measures);
+            failed |= mismatches != 0;
+            printf("{\"kernel\":\"%s\",\"detail\":\"%s\",\"checked\":%u,\"mismatches\":%u,\"pixels_per_second\":%.0f}\n",
+                k->name, k->anydetail ? "any" : detaillevel ? "low" : "high", checks, mismatches, rate);
+            if (k->anydetail) {
+                break;
+            }
+        }
+    }
+
+    H_Quit();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
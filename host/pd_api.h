@@ -0,0 +1,124 @@
+#ifndef BRUTE_H_PD_API_H
+#define BRUTE_H_PD_API_H
+
+/**
+ * Stand-in for the parts of the Playdate C API that the engine uses, for
+ * building on a host machine without the SDK. Only the members the engine
+ * touches are declared, so the layout does not match the real API.
+ */
+
+// The SDK header brings these in, and the engine relies on that.
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LCD_COLUMNS 400
+#define LCD_ROWS    240
+#define LCD_ROWSIZE 52
+
+typedef struct lua_State lua_State;
+typedef int (*lua_CFunction)(lua_State *L);
+
+// A Lua userdata object.
+typedef struct LuaUDObject LuaUDObject;
+
+typedef struct {
+    const char *name;
+    lua_CFunction func;
+} lua_reg;
+
+typedef struct {
+    const char *name;
+    int type;
+    union {
+        unsigned int intval;
+        float floatval;
+        const char *strval;
+    } v;
+} lua_val;
+
+typedef struct SDFile SDFile;
+
+typedef enum {
+    kFileRead     = (1 << 0),
+    kFileReadData = (1 << 1),
+    kFileWrite    = (1 << 2),
+    kFileAppend   = (2 << 2),
+} FileOptions;
+
+typedef struct {
+    int isdir;
+    unsigned int size;
+    int m_year;
+    int m_month;
+    int m_day;
+    int m_hour;
+    int m_minute;
+    int m_second;
+} FileStat;
+
+typedef enum {
+    kEventInit,
+    kEventInitLua,
+    kEventLock,
+    kEventUnlock,
+    kEventPause,
+    kEventResume,
+    kEventTerminate,
+    kEventKeyPressed,
+    kEventKeyReleased,
+    kEventLowPower,
+} PDSystemEvent;
+
+struct playdate_sys {
+    void *(*realloc)(void *ptr, size_t size);
+    int (*formatString)(char **ret, const char *fmt, ...);
+    void (*logToConsole)(const char *fmt, ...);
+    void (*error)(const char *fmt, ...);
+    unsigned int (*getCurrentTimeMilliseconds)(void);
+    float (*getElapsedTime)(void);
+    void (*resetElapsedTime)(void);
+};
+
+struct playdate_file {
+    int (*listfiles)(const char *path, void (*callback)(const char *path, void *userdata), void *userdata, int showhidden);
+    int (*stat)(const char *path, FileStat *stat);
+    SDFile *(*open)(const char *name, FileOptions mode);
+    int (*close)(SDFile *file);
+    int (*read)(SDFile *file, void *buf, unsigned int len);
+};
+
+struct playdate_graphics {
+    uint8_t *(*getFrame)(void);
+    void (*markUpdatedRows)(int start, int end);
+};
+
+struct playdate_lua {
+    int (*addFunction)(lua_CFunction f, const char *name, const char **outErr);
+    int (*registerClass)(const char *name, const lua_reg *reg, const lua_val *vals, int isstatic, const char **outErr);
+    int (*getArgCount)(void);
+    int (*argIsNil)(int pos);
+    int (*getArgBool)(int pos);
+    int (*getArgInt)(int pos);
+    float (*getArgFloat)(int pos);
+    const char *(*getArgString)(int pos);
+    void *(*getArgObject)(int pos, char *type, LuaUDObject **outud);
+    void (*pushNil)(void);
+    void (*pushBool)(int val);
+    void (*pushInt)(int val);
+    void (*pushFloat)(float val);
+    void (*pushString)(const char *str);
+    LuaUDObject *(*pushObject)(void *obj, char *type, int nValues);
+};
+
+typedef struct PlaydateAPI {
+    const struct playdate_sys *system;
+    const struct playdate_file *file;
+    const struct playdate_graphics *graphics;
+    const struct playdate_lua *lua;
+} PlaydateAPI;
+
+#endif
@@ -1,5 +1,8 @@
 #include "actor/actor.h"
+#include "log.h"
+#include "profile.h"
 #include "system.h"
+#include "zone.h"
 #include "map/iter.h"
 #include "map/map.h"
 
@@ -9,9 +12,17 @@
 
 #define CLIMB_SPEED 6.0f
 
+#define TAU 6.2831853f
+
+// The ID of the last actor spawned.
+static int32_t lastid = 0;
+
+// Pool of actors, which are spawned and freed often.
+static zpool_t actorpool = ZPOOL(sizeof(actor_t), ZS_ACTOR);
+
 actor_t *actor_spawn(const vector_t *pos, const map_t *map) {
     // Allocate actor.
-    actor_t *actor = playdate->system->realloc(NULL, sizeof(actor_t));
+    actor_t *actor = Z_PoolAlloc(&actorpool);
     actor->sector = &map->scts[0];
     // Add to linked list.
     list_insert(&actor->sector->actors, &actor->sectorlist);
@@ -19,11 +30,13 @@ actor_t *actor_spawn(const vector_t *pos, const map_t *map) {
     U_VecCopy(&actor->pos, pos);
     actor_update_sector(actor);
     actor->flags = 0;
+    actor->id = ++lastid;
     actor->vel.x = 0.0f;
     actor->vel.y = 0.0f;
     actor->angle = 0.0f;
     actor->zpos = actor->sector->floor;
     actor->zvel = 0.0f;
+    actor_save_state(actor);
     // Return actor.
     return actor;
 }
@@ -38,6 +51,7 @@ void actor_apply_velocity(actor_t *this) {
 }
 
 void actor_apply_gravity(actor_t *this) {
+    PROF_BEGIN(PROF_GRAVITY);
     this->zpos += this->zvel;
     // Climb up smoothly if lower than floor.
     sector_iter_init(this->sector);
@@ -69,6 +83,7 @@ void actor_apply_gravity(actor_t *this) {
     } else {
         this->zvel += GRAVITY;
     }
+    PROF_END(PROF_GRAVITY);
 }
 
 void actor_update_sector(actor_t *this) {
@@ -106,10 +121,27 @@ void actor_update_sector(actor_t *this) {
     }
 }
 
+void actor_save_state(actor_t *this) {
+    U_VecCopy(&this->prevpos, &this->pos);
+    this->prevzpos = this->zpos;
+    this->prevangle = this->angle;
+}
+
+void actor_lerp(const actor_t *this, float frac, vector_t *pos, float *zpos, float *angle) {
+    U_VecCopy(pos, &this->pos);
+    U_VecSub(pos, &this->prevpos);
+    U_VecScale(pos, frac);
+    U_VecAdd(pos, &this->prevpos);
+    *zpos = fmaf(this->zpos - this->prevzpos, frac, this->prevzpos);
+    // Turn the shortest way around.
+    float turn = remainderf(this->angle - this->prevangle, TAU);
+    *angle = fmaf(turn, frac, this->prevangle);
+}
+
 actor_t *get_actor_pointer(void) {
     actor_t *actor = playdate->lua->getArgObject(1, ACTOR_CLASS, NULL);
     if (actor == NULL)
-        playdate->system->error("Invalid actor");
+        Y_Error("Invalid actor");
     return actor;
 }
 
@@ -125,10 +157,18 @@ static int func_setPos(lua_State *L) {
     actor->pos.x = playdate->lua->getArgFloat(2);
     actor->pos.y = playdate->lua->getArgFloat(3);
     actor_update_sector(actor);
+    // Teleport instead of interpolating.
+    U_VecCopy(&actor->prevpos, &actor->pos);
 
     return 0;
 }
 
+static int func_getId(lua_State *L) {
+    actor_t *actor = get_actor_pointer();
+    playdate->lua->pushInt(actor->id);
+    return 1;
+}
+
 static int func_getVel(lua_State *L) {
     actor_t *actor = get_actor_pointer();
     playdate->lua->pushFloat(actor->vel.x);
@@ -199,13 +239,14 @@ static int func_despawn(lua_State *L) {
 
 static int func_free(lua_State *L) {
     actor_t *actor = get_actor_pointer();
-    playdate->system->realloc(actor, 0);
+    Z_PoolFree(&actorpool, actor);
     return 0;
 }
 
 static lua_reg actor_regs[] = {
     { "getPos",        func_getPos },
     { "setPos",        func_setPos },
+    { "getId",         func_getId },
     { "getVel",        func_getVel },
     { "setVel",        func_setVel },
     { "getZPos",       func_getZPos },
@@ -28,6 +28,8 @@ typedef struct {
     list_t sectorlist;
     // Various flags.
     actorflags_t flags;
+    // Unique ID, used by Lua to look up its object for this actor.
+    int32_t id;
     // The actor's position.
     vector_t pos;
     // The actor's horizontal velocity.
@@ -40,6 +42,12 @@ typedef struct {
     float angle;
     // The sector the actor was last seen in.
     sector_t *sector;
+    // The actor's position at the previous tic.
+    vector_t prevpos;
+    // The actor's vertical position at the previous tic.
+    float prevzpos;
+    // The actor's rotation at the previous tic.
+    float prevangle;
 } actor_t;
 
 // Spawn an actor.
@@ -57,6 +65,13 @@ void actor_apply_gravity(actor_t *this);
 // Update the actor's current sector.
 void actor_update_sector(actor_t *this);
 
+// Store the actor's current state as its previous tic's state. Call at the
+// start of every tic.
+void actor_save_state(actor_t *this);
+
+// Interpolate between the actor's previous and current state.
+void actor_lerp(const actor_t *this, float frac, vector_t *pos, float *zpos, float *angle);
+
 actor_t *get_actor_pointer(void);
 
 void register_actor_class(void);
@@ -0,0 +1,481 @@
+#include "log.h"
+#include "system.h"
+#include "zone.h"
+#include "asset/texture.h"
+#include "util/file.h"
+#include "util/list.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+// Number of hash buckets per texture type.
+#define NUMBUCKETS 64
+
+// Pair of texels used by placeholder textures.
+#define PLACEHOLDER_TEXELS 0x88
+
+// Just in case, we'll pack the structs we read from the files.
+#define PACKED __attribute__((__packed__))
+
+// Format of patch used in file.
+typedef struct PACKED {
+    // Packed width and height.
+    uint8_t dimensions;
+    // The shade gap.
+    uint8_t shadegap;
+    // The patch data, stored in columns.
+    uint8_t data[0];
+} file_patch_t;
+
+typedef enum {
+    TEX_PATCH,
+    TEX_FLAT,
+} textype_t;
+
+// A cached texture.
+typedef struct cached_s {
+    // Node in the LRU list, if resident. Most recently used is at the front.
+    list_t lru;
+    // The next texture in the same hash bucket.
+    struct cached_s *next;
+    // The next texture in the pending queue.
+    struct cached_s *nextpending;
+    // The lump name, padded with zeroes.
+    char name[8];
+    // The kind of texture.
+    textype_t type;
+    // True if queued to be made resident.
+    bool pending;
+    // The number of references held by maps.
+    uint16_t refs;
+    // The number of bytes of resident data, or 0 if not resident.
+    size_t size;
+    // The draw that last drew this texture, and the earliest strip that drew
+    // it in that draw, as drawstamp | strip. Written by render threads.
+    atomic_uint_least32_t drawn;
+    // The texture itself.
+    union {
+        patch_t patch;
+        flat_t flat;
+    };
+} cached_t;
+
+// Hash tables of cached textures.
+static cached_t *patchbuckets[NUMBUCKETS];
+static cached_t *flatbuckets[NUMBUCKETS];
+
+// Resident textures, in LRU order.
+static list_t lrulist = { &lrulist, &lrulist };
+
+// Queue of textures waiting to be made resident.
+static cached_t *pendinghead;
+static cached_t *pendingtail;
+
+static size_t texbudget = DEFAULT_TEXTURE_BUDGET;
+static uint8_t texloadlimit = DEFAULT_TEXTURE_LOADS;
+
+static texstats_t texstats;
+
+// Stamp of the current draw, in the bits above the strip number.
+static uint32_t drawstamp;
+
+// Placeholders drawn while textures are not resident.
+static uint8_t placeholderpixel = PLACEHOLDER_TEXELS;
+static const patch_t placeholderpatch = { 1, 1, NUMSHADES - 1, &placeholderpixel };
+static uint8_t placeholderflatdata[FLATBYTES] = { [0 ... FLATBYTES - 1] = PLACEHOLDER_TEXELS };
+static const flat_t placeholderflat = { NUMSHADES - 1, placeholderflatdata };
+
+// Hash a lump name.
+static uint8_t HashName(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (uint8_t i = 0; i < 8 && name[i]; i++) {
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    }
+    return hash % NUMBUCKETS;
+}
+
+// Find or create a texture, taking a reference to it.
+static cached_t *LookupCached(cached_t **buckets, const char *name, textype_t type) {
+    cached_t **bucket = &buckets[HashName(name)];
+    for (cached_t *cached = *bucket; cached != NULL; cached = cached->next) {
+        if (strncmp(cached->name, name, sizeof(cached->name)) == 0) {
+            if (cached->refs++ == 0) {
+                texstats.unused -= cached->size;
+            }
+            ++texstats.hits;
+            return cached;
+        }
+    }
+    ++texstats.misses;
+    // Create a texture that is not yet resident.
+    cached_t *cached = Z_Malloc(sizeof(cached_t), PU_STATIC, NULL, ZS_TEXTURE);
+    memset(cached, 0, sizeof(cached_t));
+    strncpy(cached->name, name, sizeof(cached->name));
+    cached->type = type;
+    cached->refs = 1;
+    cached->next = *bucket;
+    *bucket = cached;
+    ++texstats.textures;
+    return cached;
+}
+
+// Get the cached texture containing a patch or flat.
+static cached_t *GetCached(const void *texture) {
+    // Both union members share the same offset.
+    return (cached_t *) ((uint8_t *) texture - offsetof(cached_t, patch));
+}
+
+// Free the resident data of a texture. The zone may have purged it already.
+static void FreeCachedData(cached_t *cached) {
+    list_remove(&cached->lru);
+    if (cached->type == TEX_PATCH) {
+        Z_Free(cached->patch.data);
+    } else {
+        Z_Free(cached->flat.data);
+    }
+    texstats.bytes -= cached->size;
+    if (cached->refs == 0) {
+        texstats.unused -= cached->size;
+    }
+    cached->size = 0;
+}
+
+// Evict a texture to make room for another.
+static void EvictCached(cached_t *cached) {
+    FreeCachedData(cached);
+    ++texstats.evictions;
+}
+
+// Remove a texture from the pending queue.
+static void UnqueueCached(cached_t *cached) {
+    cached_t *prev = NULL;
+    for (cached_t *it = pendinghead; it != NULL; prev = it, it = it->nextpending) {
+        if (it == cached) {
+            if (prev == NULL) {
+                pendinghead = it->nextpending;
+            } else {
+                prev->nextpending = it->nextpending;
+            }
+            if (pendingtail == it) {
+                pendingtail = prev;
+            }
+            cached->pending = false;
+            --texstats.pending;
+            return;
+        }
+    }
+}
+
+// Free an unreferenced texture, along with its data.
+static void FreeCached(cached_t *cached) {
+    cached_t **link = &(cached->type == TEX_PATCH ? patchbuckets : flatbuckets)[HashName(cached->name)];
+    while (*link != cached) {
+        link = &(*link)->next;
+    }
+    *link = cached->next;
+    if (cached->size != 0) {
+        FreeCachedData(cached);
+    }
+    if (cached->pending) {
+        UnqueueCached(cached);
+    }
+    --texstats.textures;
+    Z_Free(cached);
+}
+
+// Drop a reference to a texture.
+static void ReleaseCached(cached_t *cached) {
+    if (cached->refs == 0) {
+        Y_Error("W_Release: Texture %.8s is not referenced", cached->name);
+    }
+    if (--cached->refs == 0) {
+        if (cached->size == 0) {
+            // Not worth keeping a record of a texture with no data.
+            FreeCached(cached);
+        } else {
+            texstats.unused += cached->size;
+        }
+    }
+}
+
+// Evict least recently used textures until the given size fits in the budget.
+static void MakeRoom(size_t size) {
+    while (texstats.bytes + size > texbudget && lrulist.prev != &lrulist) {
+        cached_t *cached = (cached_t *) lrulist.prev;
+        EvictCached(cached);
+        if (cached->refs == 0) {
+            // Nothing will draw the texture again, so drop its record too.
+            FreeCached(cached);
+        }
+    }
+}
+
+// Load the data of a patch.
+static size_t LoadPatchData(patch_t *patch, const char *name) {
+    char *path;
+    playdate->system->formatString(&path, "assets/patches/%.8s", name);
+    size_t size;
+    SDFile *file = open_file(path, &size);
+    // Verify the file at least has the header.
+    if (size < sizeof(file_patch_t)) {
+        Y_Error("W_Load: Patch missing dimensions");
+    }
+    file_patch_t fpatch;
+    read_file_part(file, &fpatch, sizeof(file_patch_t), path);
+    if (fpatch.shadegap >= NUMSHADES) {
+        Y_Error("W_Load: Patch shade gap out of range");
+    }
+    // Get the dimensions.
+    uint16_t width = 1 << (fpatch.dimensions & 15);
+    uint16_t height = 1 << (fpatch.dimensions >> 4);
+    if (width < 1 || height < 1) {
+        Y_Error("W_Load: Patch too small");
+    }
+    // Verify the size is as promised.
+    size_t datasize = PATCHCOLUMNBYTES(height) * width;
+    if (size < sizeof(file_patch_t) + datasize) {
+        Y_Error("W_Load: Patch missing data");
+    }
+    // Read the data straight into the patch.
+    MakeRoom(datasize);
+    patch->width = width;
+    patch->height = height;
+    patch->shadegap = fpatch.shadegap;
+    Z_Malloc(datasize, PU_CACHE, (void **) &patch->data, ZS_TEXTURE);
+    read_file_part(file, patch->data, datasize, path);
+    playdate->file->close(file);
+    playdate->system->realloc(path, 0);
+    return datasize;
+}
+
+// Load the data of a flat.
+static size_t LoadFlatData(flat_t *flat, const char *name) {
+    char *path;
+    playdate->system->formatString(&path, "assets/flats/%.8s", name);
+    size_t size;
+    SDFile *file = open_file(path, &size);
+    // A flat is its shade gap followed by the data.
+    if (size < 1 + FLATBYTES) {
+        Y_Error("W_Load: Flat missing data");
+    }
+    uint8_t shadegap;
+    read_file_part(file, &shadegap, 1, path);
+    if (shadegap >= NUMSHADES) {
+        Y_Error("W_Load: Flat shade gap out of range");
+    }
+    // Read the data straight into the flat.
+    MakeRoom(FLATBYTES);
+    flat->shadegap = shadegap;
+    Z_Malloc(FLATBYTES, PU_CACHE, (void **) &flat->data, ZS_TEXTURE);
+    read_file_part(file, flat->data, FLATBYTES, path);
+    playdate->file->close(file);
+    playdate->system->realloc(path, 0);
+    return FLATBYTES;
+}
+
+// Make a texture resident.
+static void LoadCached(cached_t *cached) {
+    if (cached->type == TEX_PATCH) {
+        cached->size = LoadPatchData(&cached->patch, cached->name);
+    } else {
+        cached->size = LoadFlatData(&cached->flat, cached->name);
+    }
+    list_insert(&lrulist, &cached->lru);
+    texstats.bytes += cached->size;
+    if (cached->refs == 0) {
+        texstats.unused += cached->size;
+    }
+    ++texstats.loads;
+}
+
+// Check if the zone purged the data of a resident texture.
+static bool IsPurged(const cached_t *cached) {
+    return (cached->type == TEX_PATCH ? cached->patch.data : cached->flat.data) == NULL;
+}
+
+// Mark a texture as used, queueing it to be loaded if not resident.
+static bool UseCached(cached_t *cached) {
+    if (cached->size != 0 && IsPurged(cached)) {
+        // The zone needed the memory, so count it as evicted.
+        EvictCached(cached);
+    }
+    if (cached->size != 0) {
+        // Move to front of LRU list.
+        list_remove(&cached->lru);
+        list_insert(&lrulist, &cached->lru);
+        return true;
+    }
+    if (!cached->pending) {
+        cached->pending = true;
+        cached->nextpending = NULL;
+        if (pendingtail == NULL) {
+            pendinghead = cached;
+        } else {
+            pendingtail->nextpending = cached;
+        }
+        pendingtail = cached;
+        ++texstats.pending;
+    }
+    return false;
+}
+
+// Free unreferenced textures in a hash table.
+static void PurgeBuckets(cached_t **buckets) {
+    for (uint8_t i = 0; i < NUMBUCKETS; i++) {
+        cached_t *cached = buckets[i];
+        while (cached != NULL) {
+            cached_t *next = cached->next;
+            if (cached->refs == 0) {
+                FreeCached(cached);
+            }
+            cached = next;
+        }
+    }
+}
+
+patch_t *W_CachePatch(const char *name) {
+    return &LookupCached(patchbuckets, name, TEX_PATCH)->patch;
+}
+
+void W_ReleasePatch(patch_t *patch) {
+    ReleaseCached(GetCached(patch));
+}
+
+flat_t *W_CacheFlat(const char *name) {
+    return &LookupCached(flatbuckets, name, TEX_FLAT)->flat;
+}
+
+void W_ReleaseFlat(flat_t *flat) {
+    ReleaseCached(GetCached(flat));
+}
+
+const patch_t *W_UsePatch(const patch_t *patch) {
+    if (patch == NULL || UseCached(GetCached(patch))) {
+        return patch;
+    }
+    return &placeholderpatch;
+}
+
+const flat_t *W_UseFlat(const flat_t *flat) {
+    if (flat == NULL || UseCached(GetCached(flat))) {
+        return flat;
+    }
+    return &placeholderflat;
+}
+
+// Check if a texture can be drawn without loading it first.
+static bool IsResident(const cached_t *cached) {
+    return cached->size != 0 && !IsPurged(cached);
+}
+
+const patch_t *W_ResidentPatch(const patch_t *patch) {
+    if (patch == NULL || IsResident(GetCached(patch))) {
+        return patch;
+    }
+    return &placeholderpatch;
+}
+
+const flat_t *W_ResidentFlat(const flat_t *flat) {
+    if (flat == NULL || IsResident(GetCached(flat))) {
+        return flat;
+    }
+    return &placeholderflat;
+}
+
+void W_BeginDraw(void) {
+    drawstamp += 1 << 8;
+    // Textures never drawn have a stamp of 0, so skip it when wrapping.
+    if (drawstamp == 0) {
+        drawstamp = 1 << 8;
+    }
+}
+
+bool W_MarkDrawn(const void *texture, uint8_t strip) {
+    cached_t *cached = GetCached(texture);
+    uint32_t stamp = drawstamp | strip;
+    uint32_t old = atomic_load_explicit(&cached->drawn, memory_order_relaxed);
+    do {
+        if ((old & ~(uint32_t) 0xff) == drawstamp && (old & 0xff) <= strip) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(
+        &cached->drawn, &old, stamp, memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
+
+bool W_FirstDrawnBy(const void *texture, uint8_t strip) {
+    return atomic_load_explicit(&GetCached(texture)->drawn, memory_order_relaxed) == (drawstamp | strip);
+}
+
+void W_LoadPendingTextures(void) {
+    for (uint8_t i = 0; i < texloadlimit && pendinghead != NULL; i++) {
+        cached_t *cached = pendinghead;
+        pendinghead = cached->nextpending;
+        if (pendinghead == NULL) {
+            pendingtail = NULL;
+        }
+        cached->pending = false;
+        --texstats.pending;
+        LoadCached(cached);
+    }
+}
+
+void W_SetTextureBudget(size_t budget) {
+    // Textures past what the zone can hold would be purged by the zone in no
+    // particular order, rather than evicted least recently used first.
+    // Free memory includes purgeable memory, so resident textures count.
+    size_t room = Z_FreeMemory();
+    if (budget > room) {
+        budget = room;
+    }
+    texbudget = budget;
+    MakeRoom(0);
+}
+
+void W_SetTextureLoadLimit(uint8_t limit) {
+    texloadlimit = limit;
+}
+
+void W_PurgeTextures(void) {
+    PurgeBuckets(patchbuckets);
+    PurgeBuckets(flatbuckets);
+}
+
+void W_GetTextureStats(texstats_t *stats) {
+    *stats = texstats;
+}
+
+static int func_stats(lua_State *L) {
+    playdate->lua->pushInt(texstats.hits);
+    playdate->lua->pushInt(texstats.misses);
+    playdate->lua->pushInt(texstats.bytes);
+    playdate->lua->pushInt(texstats.unused);
+    playdate->lua->pushInt(texstats.textures);
+    playdate->lua->pushInt(texstats.loads);
+    playdate->lua->pushInt(texstats.evictions);
+    playdate->lua->pushInt(texstats.pending);
+    return 8;
+}
+
+static int func_purge(lua_State *L) {
+    W_PurgeTextures();
+    return 0;
+}
+
+static int func_setBudget(lua_State *L) {
+    W_SetTextureBudget(playdate->lua->getArgInt(1));
+    return 0;
+}
+
+static int func_setLoadLimit(lua_State *L) {
+    W_SetTextureLoadLimit(playdate->lua->getArgInt(1));
+    return 0;
+}
+
+void register_texture_functions(void) {
+    playdate->lua->addFunction(func_stats, "brute.textures.stats", NULL);
+    playdate->lua->addFunction(func_purge, "brute.textures.purge", NULL);
+    playdate->lua->addFunction(func_setBudget, "brute.textures.setBudget", NULL);
+    playdate->lua->addFunction(func_setLoadLimit, "brute.textures.setLoadLimit", NULL);
+}
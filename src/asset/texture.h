@@ -0,0 +1,96 @@
+#ifndef BRUTE_W_TEXTURE_H
+#define BRUTE_W_TEXTURE_H
+
+/**
+ * Reference-counted texture cache shared by all loaded maps. Textures are
+ * keyed by their 8-byte lump name. Maps only take references to textures;
+ * texture data is made resident the first time the renderer uses it, and the
+ * least recently used data is evicted to stay within a memory budget. Until a
+ * texture is resident, a placeholder is drawn in its place. Textures no map
+ * references are only kept while their data is resident.
+ */
+
+#include "map/defs.h"
+
+// Default memory budget for resident texture data, in bytes.
+#define DEFAULT_TEXTURE_BUDGET (1024 * 1024)
+
+// Default maximum number of textures made resident per frame.
+#define DEFAULT_TEXTURE_LOADS 4
+
+// Texture cache statistics.
+typedef struct {
+    uint32_t hits;      // Number of lookups that found a cached texture.
+    uint32_t misses;    // Number of lookups that had to create a texture.
+    uint32_t loads;     // Number of times texture data was made resident.
+    uint32_t evictions; // Number of times texture data was evicted.
+    size_t   bytes;     // Number of bytes of resident texture data.
+    size_t   unused;    // Number of those bytes used by unreferenced textures.
+    uint16_t textures;  // Number of cached textures.
+    uint16_t pending;   // Number of textures waiting to be made resident.
+} texstats_t;
+
+// Get a reference to a patch. Its data is not loaded until it is used.
+patch_t *W_CachePatch(const char *name);
+
+// Release a reference to a patch.
+void W_ReleasePatch(patch_t *patch);
+
+// Get a reference to a flat. Its data is not loaded until it is used.
+flat_t *W_CacheFlat(const char *name);
+
+// Release a reference to a flat.
+void W_ReleaseFlat(flat_t *flat);
+
+// Mark a patch as used for drawing. Returns the patch if its data is
+// resident, or a placeholder otherwise, in which case the patch is queued to
+// be made resident. NULL is passed through.
+const patch_t *W_UsePatch(const patch_t *patch);
+
+// Mark a flat as used for drawing, as with W_UsePatch.
+const flat_t *W_UseFlat(const flat_t *flat);
+
+// Get what to draw for a patch without marking it as used: the patch if its
+// data is resident, or a placeholder otherwise. This changes nothing, so
+// render threads may call it while the main thread is not using the cache.
+// Pass the patch to W_UsePatch afterwards to keep it resident.
+const patch_t *W_ResidentPatch(const patch_t *patch);
+
+// Get what to draw for a flat, as with W_ResidentPatch.
+const flat_t *W_ResidentFlat(const flat_t *flat);
+
+// Start a new draw for W_MarkDrawn. Call before the strips start drawing.
+void W_BeginDraw(void);
+
+// Mark a patch or flat as drawn by a strip, numbered from 0. Returns true if
+// neither this strip nor an earlier one has marked it since W_BeginDraw, so
+// each strip records a texture at most once. Render threads may call this.
+bool W_MarkDrawn(const void *texture, uint8_t strip);
+
+// Check if a strip was the earliest to mark a patch or flat as drawn since
+// W_BeginDraw, so that each texture is passed to W_UsePatch or W_UseFlat once,
+// in an order that does not depend on which thread drew which strip.
+bool W_FirstDrawnBy(const void *texture, uint8_t strip);
+
+// Make queued textures resident, up to the per-frame limit. Call once per
+// frame, after drawing.
+void W_LoadPendingTextures(void);
+
+// Set the memory budget for resident texture data, evicting if needed. The
+// budget is clamped to the zone's free and purgeable memory at the time of the
+// call. Other allocations made later may still purge texture data.
+void W_SetTextureBudget(size_t budget);
+
+// Set the maximum number of textures made resident per frame.
+void W_SetTextureLoadLimit(uint8_t limit);
+
+// Free all textures that are not referenced by any map, including those kept
+// for their resident data.
+void W_PurgeTextures(void);
+
+// Get the texture cache statistics.
+void W_GetTextureStats(texstats_t *stats);
+
+void register_texture_functions(void);
+
+#endif
@@ -0,0 +1,174 @@
+#include "log.h"
+#include "system.h"
+#include "tic.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// Maximum length of a formatted message.
+#define MAXMSGLEN 256
+
+// A message definition.
+typedef struct {
+    // Type of each argument: 'i' for int, 'f' for float, and 's' for a string
+    // that outlives the frame, such as a literal.
+    const char *args;
+    // printf format of the message, with one conversion per argument.
+    const char *format;
+} ymsgdef_t;
+
+static const ymsgdef_t messages[NUMYMSGS] = {
+    [YM_VISWALLS]    = { "i", "FinishStrips: Out of viswalls, %d walls may show sprites through them" },
+    [YM_CLIPBUFFER]  = { "i", "FinishStrips: Out of clip buffer, %d walls may show sprites through them" },
+    [YM_SECTORDEPTH] = { "i", "FinishStrips: Sector stack too deep, %d portals not drawn" },
+    [YM_VISSECTORS]  = { "i", "FinishStrips: Out of vissectors, actors of %d sectors not drawn" },
+    [YM_TEXUSES]     = { "i", "FinishStrips: Out of texture uses, %d textures may be purged" },
+};
+
+static const char *levelnames[] = {
+    [YL_DEBUG] = "debug",
+    [YL_INFO]  = "info",
+    [YL_WARN]  = "warn",
+};
+
+// An argument of a logged message.
+typedef union {
+    int32_t i;
+    float f;
+    const char *s;
+} yarg_t;
+
+// A logged message.
+typedef struct {
+    // Tic the message was logged on.
+    uint32_t tic;
+    // The message.
+    uint8_t msg;
+    // Severity of the message.
+    uint8_t level;
+    // Arguments of the message.
+    yarg_t args[YMAXARGS];
+} yrecord_t;
+
+static yrecord_t ring[YRINGSIZE];
+// Number of messages logged so far. The newest is at (written - 1) % YRINGSIZE.
+static uint32_t written;
+// Number of messages flushed so far.
+static uint32_t flushed;
+
+void Y_Log(uint8_t level, ymsg_t msg, ...) {
+    yrecord_t *record = &ring[written++ % YRINGSIZE];
+    record->tic = gametic;
+    record->msg = msg;
+    record->level = level;
+    va_list args;
+    va_start(args, msg);
+    const char *types = messages[msg].args;
+    for (int i = 0; types[i] != '\0'; i++) {
+        switch (types[i]) {
+            case 'i':
+                record->args[i].i = va_arg(args, int);
+                break;
+            case 'f':
+                record->args[i].f = va_arg(args, double);
+                break;
+            case 's':
+                record->args[i].s = va_arg(args, const char *);
+                break;
+        }
+    }
+    va_end(args);
+}
+
+// Format a logged message into buf.
+static void FormatRecord(char *buf, const yrecord_t *record) {
+    size_t len = snprintf(buf, MAXMSGLEN, "[%u] %s: ", (unsigned) record->tic, levelnames[record->level]);
+    const char *format = messages[record->msg].format;
+    int arg = 0;
+    while (*format != '\0' && len < MAXMSGLEN - 1) {
+        if (*format != '%') {
+            buf[len++] = *format++;
+            continue;
+        }
+        if (format[1] == '%') {
+            buf[len++] = '%';
+            format += 2;
+            continue;
+        }
+        // Copy the conversion so it can be formatted on its own.
+        char spec[16];
+        size_t speclen = 0;
+        do {
+            spec[speclen++] = *format++;
+        } while (*format != '\0' && strchr("diuxXcfgeEs", *format) == NULL && speclen < sizeof(spec) - 2);
+        char conv = *format;
+        if (conv != '\0') {
+            spec[speclen++] = *format++;
+        }
+        spec[speclen] = '\0';
+        const yarg_t *value = &record->args[arg++];
+        int n;
+        switch (conv) {
+            case 'f':
+            case 'g':
+            case 'e':
+            case 'E':
+                n = snprintf(&buf[len], MAXMSGLEN - len, spec, (double) value->f);
+                break;
+            case 's':
+                n = snprintf(&buf[len], MAXMSGLEN - len, spec, value->s);
+                break;
+            default:
+                n = snprintf(&buf[len], MAXMSGLEN - len, spec, (int) value->i);
+                break;
+        }
+        if (n > 0) {
+            len += n;
+        }
+    }
+    if (len > MAXMSGLEN - 1) {
+        len = MAXMSGLEN - 1;
+    }
+    buf[len] = '\0';
+}
+
+// Write logged messages from first up to written to the console.
+static void WriteRecords(uint32_t first) {
+    char buf[MAXMSGLEN];
+    for (uint32_t i = first; i != written; i++) {
+        FormatRecord(buf, &ring[i % YRINGSIZE]);
+        playdate->system->logToConsole("%s", buf);
+    }
+}
+
+void Y_Flush(void) {
+    if (flushed == written) {
+        return;
+    }
+    if (written - flushed > YRINGSIZE) {
+        playdate->system->logToConsole("Y_Flush: %u messages lost", (unsigned) (written - flushed - YRINGSIZE));
+        flushed = written - YRINGSIZE;
+    }
+    WriteRecords(flushed);
+    flushed = written;
+}
+
+void Y_Dump(void) {
+    uint32_t count = written < YRINGSIZE ? written : YRINGSIZE;
+    if (count != 0) {
+        playdate->system->logToConsole("Last %u log messages:", (unsigned) count);
+        WriteRecords(written - count);
+    }
+    flushed = written;
+}
+
+void Y_Error(const char *fmt, ...) {
+    Y_Dump();
+    char buf[MAXMSGLEN];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    playdate->system->error("%s", buf);
+}
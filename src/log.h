@@ -0,0 +1,81 @@
+#ifndef BRUTE_Y_LOG_H
+#define BRUTE_Y_LOG_H
+
+/**
+ * Logging. Messages are predefined, and logging one only stores its number
+ * and arguments in a ring buffer, so it is cheap enough for the renderer's
+ * inner loops. The buffer is formatted and written to the console at the end
+ * of each frame by Y_Flush. Y_Error dumps the most recent messages, including
+ * those already flushed, before reporting a fatal error.
+ *
+ * Messages below YLOGLEVEL compile to nothing. It defaults to YL_DEBUG in
+ * debug builds and YL_WARN otherwise.
+ */
+
+#include "types.h"
+
+// Severity levels. Plain defines so YLOGLEVEL can be tested by the
+// preprocessor.
+#define YL_DEBUG 0 // Detail only useful when debugging.
+#define YL_INFO  1 // Normal events worth knowing about.
+#define YL_WARN  2 // Something went wrong, but the game can carry on.
+
+#ifndef YLOGLEVEL
+#ifdef _DEBUG
+#define YLOGLEVEL YL_DEBUG
+#else
+#define YLOGLEVEL YL_WARN
+#endif
+#endif
+
+// Number of messages the ring buffer holds. Messages logged faster than they
+// are flushed overwrite the oldest ones.
+#define YRINGSIZE 64
+
+// Maximum number of arguments of a message.
+#define YMAXARGS 4
+
+// Messages that can be logged. Their formats are defined in log.c.
+typedef enum {
+    YM_VISWALLS,    // Walls that did not fit in the viswall array.
+    YM_CLIPBUFFER,  // Walls that did not fit in the clip buffer.
+    YM_SECTORDEPTH, // Portals that did not fit on the sector stack.
+    YM_VISSECTORS,  // Sectors whose actors were not queued.
+    YM_TEXUSES,     // Textures that were not marked as used.
+    NUMYMSGS,
+} ymsg_t;
+
+// Store a message and its arguments in the ring buffer. Use the Y_DEBUG,
+// Y_INFO and Y_WARN macros instead, so that messages below YLOGLEVEL are
+// compiled out.
+void Y_Log(uint8_t level, ymsg_t msg, ...);
+
+// Format and write the messages logged since the last flush to the console.
+void Y_Flush(void);
+
+// Write the most recent messages to the console, including flushed ones.
+void Y_Dump(void);
+
+// Dump the log and report a fatal error. Use this instead of calling the
+// system's error function directly.
+void Y_Error(const char *fmt, ...);
+
+#if YLOGLEVEL <= YL_DEBUG
+#define Y_DEBUG(...) Y_Log(YL_DEBUG, __VA_ARGS__)
+#else
+#define Y_DEBUG(...) ((void) 0)
+#endif
+
+#if YLOGLEVEL <= YL_INFO
+#define Y_INFO(...) Y_Log(YL_INFO, __VA_ARGS__)
+#else
+#define Y_INFO(...) ((void) 0)
+#endif
+
+#if YLOGLEVEL <= YL_WARN
+#define Y_WARN(...) Y_Log(YL_WARN, __VA_ARGS__)
+#else
+#define Y_WARN(...) ((void) 0)
+#endif
+
+#endif
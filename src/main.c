@@ -1,13 +1,18 @@
 #include "system.h"
+#include "tic.h"
 #include "video.h"
 #include "map/load.h"
 #include "render/actor.h"
 #include "render/draw.h"
 #include "render/main.h"
+#include "util/angle.h"
 
 void B_MainInit(void) {
     // Init modules.
     load_sprites();
+    R_InitLighting();
+    U_InitAngles();
+    B_ClockReset();
 }
 
 void B_MainQuit(void) {
@@ -8,20 +8,40 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Textures store two texels per byte, the even texel in the low nibble. A
+// texture can use 16 of the 17 shades, and its shade gap is the one it leaves
+// out: a texel's shade is its nibble if below the gap, or one more otherwise.
+
+// Number of shades, and so of possible shade gaps.
+#define NUMSHADES 17
+
+// Number of bytes in a column of a patch of the given height.
+#define PATCHCOLUMNBYTES(_height_) (((_height_) + 1) >> 1)
+
 // A wall texture, or "patch".
 typedef struct {
     // The width of the texture.
     uint16_t width;
-    // The height of the texture. Stride is height.
+    // The height of the texture. Stride is PATCHCOLUMNBYTES(height).
     uint16_t height;
+    // The shade gap of the texture.
+    uint8_t shadegap;
     // The texture data, stored in columns.
     uint8_t *data;
 } patch_t;
 
+// Number of pixels in a flat.
+#define FLATSIZE (64 * 64)
+
+// Number of bytes of data in a flat.
+#define FLATBYTES (FLATSIZE / 2)
+
 // A floor/ceiling texture, or "flat". All flats are 64x64 pixels in size.
 typedef struct {
+    // The shade gap of the texture.
+    uint8_t shadegap;
     // The texture data, stored in rows.
-    uint8_t data[64 * 64];
+    uint8_t *data;
 } flat_t;
 
 typedef struct {
@@ -62,10 +82,19 @@ typedef struct sector_s {
     uint16_t num_walls;
     // The walls in this sector.
     wall_t *walls;
+    // Line equations of the walls, stored as contiguous arrays so that
+    // containment tests don't have to touch the walls themselves. A point
+    // (x, y) is in front of wall i when a[i] * x + b[i] * y + c[i] >= 0.
+    // (a, b) is the unit normal, so the result is a distance.
+    const float *edge_a;
+    const float *edge_b;
+    const float *edge_c;
     // The floor height.
     int16_t floor;
     // The ceiling height.
     int16_t ceiling;
+    // The light level, from 0 to 255.
+    uint8_t light;
     // The flat used for this sector's floor.
     flat_t *floorflat;
     // The flat used for this sector's ceiling.
@@ -85,12 +114,15 @@ typedef struct {
     wall_t *walls;
     // The number of walls in this map.
     size_t numwalls;
-    // The patches in this map.
-    patch_t *patches;
+    // The wall line equations in this map, as three arrays of numwalls
+    // floats each: all a coefficients, then all b, then all c.
+    float *edges;
+    // The patches in this map, owned by the texture cache.
+    patch_t **patches;
     // The number of patches in this map.
     size_t numpatches;
-    // The flats in this map.
-    flat_t *flats;
+    // The flats in this map, owned by the texture cache.
+    flat_t **flats;
     // The number of flats in this map.
     size_t numflats;
     // Reference to Lua object used to keep map alive while actors exist.
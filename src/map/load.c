@@ -1,4 +1,7 @@
+#include "log.h"
 #include "system.h"
+#include "zone.h"
+#include "asset/texture.h"
 #include "map/load.h"
 #include "util/file.h"
 #include "util/vec.h"
@@ -9,21 +12,61 @@
 // Just in case, we'll pack the structs we read from the files.
 #define PACKED __attribute__((__packed__))
 
-// Format of patch used in file.
+// Map file magic number.
+#define MAP_MAGIC "BMAP"
+
+// Map file format version.
+#define MAP_VERSION 3
+
+// Maximum number of sections in a map file.
+#define MAX_SECTIONS 16
+
+// Number of bytes of the map file read per load step.
+#define LOAD_CHUNK_SIZE 4096
+
+// Number of walls or sectors converted per load step.
+#define LOAD_BATCH_SIZE 16
+
+// If defined, maps are always validated and their precalculated data is
+// always recalculated, even when the checksum matches.
+#ifdef _DEBUG
+#define MAP_ALWAYS_VALIDATE
+#endif
+
+// FNV-1a parameters for the map checksum.
+#define CHECKSUM_BASIS 2166136261u
+#define CHECKSUM_PRIME 16777619u
+
+// Round a size up for pointer alignment.
+#define ALIGN(_size_) (((_size_) + 7) & ~(size_t) 7)
+
+// Format of a section table entry used in file.
 typedef struct PACKED {
-    // Packed width and height.
-    uint8_t dimensions;
-    // The patch data, stored in columns.
-    uint8_t data[0];
-} file_patch_t;
+    // The tag identifying the section's contents.
+    char tag[4];
+    // The offset of the section from the start of the file.
+    uint32_t offset;
+    // The size of the section in bytes.
+    uint32_t size;
+} file_section_t;
 
-// Format of vertex used in file.
+// Format of the header used in file.
 typedef struct PACKED {
-    // The X coordinate of the vertex.
-    int16_t x;
-    // The Y coordinate of the vertex.
-    int16_t y;
-} file_vertex_t;
+    // Magic number, MAP_MAGIC.
+    char magic[4];
+    // Format version, MAP_VERSION.
+    uint16_t version;
+    // The number of sections.
+    uint16_t numsections;
+    // FNV-1a checksum of everything after the section table.
+    uint32_t checksum;
+    // The section table.
+    file_section_t sections[0];
+} file_header_t;
+
+// Vertices are stored as vector_t in file so that they can be used in place.
+// Likewise, wall line equations are stored in the layout of map_t's edges,
+// and sector bounding boxes are stored as aabb_t.
 
 // Format of sector used in file.
 typedef struct PACKED {
@@ -39,6 +82,8 @@ typedef struct PACKED {
     uint8_t floorflat;
     // The flat ID for the ceiling.
     uint8_t ceilflat;
+    // The light level.
+    uint8_t light;
 } file_sector_t;
 
 // Format of a wall used in file.
@@ -61,100 +106,84 @@ typedef struct PACKED {
     uint8_t texbot;
 } file_wall_t;
 
-static const char *mapname;
+// Format of precalculated wall data used in file.
+typedef struct PACKED {
+    // Precalculated v2 - v1.
+    vector_t delta;
+    // Precalculated normal vector.
+    vector_t normal;
+    // Precalculated length.
+    float length;
+} file_wallcalc_t;
 
-static void *ReadMapFile(const char *file, size_t *szp, size_t mbsz) {
-    // Read file.
-    char *path;
-    playdate->system->formatString(&path, "assets/maps/%s/%s", mapname, file);
-    void *result = read_file(path, szp);
-    playdate->system->realloc(path, 0);
-    // Divide size by member count.
-    *szp /= mbsz;
-    // Return file contents.
-    return result;
-}
+// Stages of map loading, in order.
+typedef enum {
+    LOAD_OPEN,    // Open the file, read the header, and allocate the map.
+    LOAD_READ,    // Read the file contents in chunks.
+    LOAD_PATCHES, // Look up the patches, one per step.
+    LOAD_FLATS,   // Look up the flats, one per step.
+    LOAD_WALLS,   // Convert the walls in batches.
+    LOAD_SECTORS, // Convert the sectors and finish the walls in batches.
+    LOAD_DONE,    // The map is ready.
+} loadstage_t;
 
-// Load a patch from a bitmap.
-static void LoadPatch(patch_t *patch, const char *name) {
+struct maploader_s {
+    // The current stage.
+    loadstage_t stage;
+    // Progress within the current stage.
+    size_t index;
+    // The name of the map being loaded.
+    char *name;
+    // The path of the map file.
     char *path;
-    playdate->system->formatString(&path, "assets/patches/%.8s", name);
-    size_t size;
-    file_patch_t *fpatch = read_file(path, &size);
-    playdate->system->realloc(path, 0);
-    // Verify the allocation at least has the dimensions.
-    if (size < 1) {
-        playdate->system->error("M_Load: Patch missing dimensions");
-    }
-    // Get the dimensions.
-    uint16_t width = 1 << (fpatch->dimensions & 15);
-    uint16_t height = 1 << (fpatch->dimensions >> 4);
-    if (width < 1 || height < 1) {
-        playdate->system->error("M_Load: Patch too small");
-    }
-    // Verify the size is as promised.
-    size_t datasize = height * width;
-    if (size < 1 + datasize) {
-        playdate->system->error("M_Load: Patch missing data");
-    }
-    // Allocate patch and copy data over.
-    patch->width = width;
-    patch->height = height;
-    patch->data = playdate->system->realloc(NULL, datasize);
-    memcpy(&patch->data[0], &fpatch->data[0], datasize);
-    // Free the file data.
-    playdate->system->realloc(fpatch, 0);
-}
+    // The map file, while it is being read.
+    SDFile *file;
+    // The map being loaded.
+    map_t *map;
+    // The file contents, freed once the map is loaded.
+    uint8_t *blob;
+    // The size of the file contents.
+    size_t blobsize;
+    // The expected checksum, and the checksum of what has been read so far.
+    uint32_t checksum;
+    uint32_t readchecksum;
+    // If true, the checksum matched and the map is trusted, so validation is
+    // skipped and precalculated data is used as-is.
+    bool trusted;
+    // The sections of the file contents.
+    const char *patches;
+    const char *flats;
+    const file_sector_t *sectors;
+    const file_wall_t *walls;
+    const file_wallcalc_t *wallcalcs;
+    const aabb_t *bounds;
+};
 
-static void LoadPatches(map_t *map) {
-    char *fpatches = ReadMapFile("patches", &map->numpatches, sizeof(char[8]));
-    // Each 8 bytes is a patch name.
-    map->patches = playdate->system->realloc(NULL, sizeof(patch_t) * map->numpatches);
-    for (size_t i = 0; i < map->numpatches; i++) {
-        LoadPatch(&map->patches[i], &fpatches[8 * i]);
-    }
-    // Free file data.
-    playdate->system->realloc(fpatches, 0);
-}
-
-// Load a flat from a bitmap.
-static void LoadFlat(flat_t *flat, const char *name) {
-    char *path;
-    playdate->system->formatString(&path, "assets/flats/%.8s", name);
-    size_t size;
-    uint8_t *fflat = read_file(path, &size);
-    playdate->system->realloc(path, 0);
-    if (size < 4096) {
-        playdate->system->error("M_Load: Flat missing data");
-    }
-    // Copy the data.
-    memcpy(&flat->data[0], fflat, sizeof(flat->data));
-    // Free file data.
-    playdate->system->realloc(fflat, 0);
-}
-
-static void LoadFlats(map_t *map) {
-    char *fflats = ReadMapFile("flats", &map->numflats, sizeof(char[8]));
-    // Each 8 bytes is a patch name.
-    map->flats = playdate->system->realloc(NULL, sizeof(flat_t) * map->numflats);
-    for (size_t i = 0; i < map->numflats; i++) {
-        LoadFlat(&map->flats[i], &fflats[8 * i]);
-    }
-    // Free file data.
-    playdate->system->realloc(fflats, 0);
-}
-
-static void LoadVertices(map_t *map) {
-    file_vertex_t *fvtxs = ReadMapFile("vertices", &map->numvtxs, sizeof(file_vertex_t));
-    // Allocate vertices.
-    map->vtxs = playdate->system->realloc(NULL, sizeof(vector_t) * map->numvtxs);
-    // Convert vertices.
-    for (size_t i = 0; i < map->numvtxs; i++) {
-        map->vtxs[i].x = fvtxs[i].x;
-        map->vtxs[i].y = fvtxs[i].y;
+// Find a section in the header, returning its data and element count.
+static const void *FindSection(
+    const uint8_t *blob,
+    size_t blobsize,
+    const char *tag,
+    size_t mbsz,
+    size_t *count
+) {
+    const file_header_t *header = (const file_header_t *) blob;
+    for (uint16_t i = 0; i < header->numsections; i++) {
+        const file_section_t *section = &header->sections[i];
+        if (memcmp(section->tag, tag, sizeof(section->tag)) != 0) {
+            continue;
+        }
+        if (section->offset > blobsize || section->size > blobsize - section->offset) {
+            Y_Error("M_Load: Section %.4s is out of bounds", tag);
+        }
+        if (section->size % mbsz != 0) {
+            Y_Error("M_Load: Section %.4s has a partial element", tag);
+        }
+        *count = section->size / mbsz;
+        return &blob[section->offset];
     }
-    // Free file data.
-    playdate->system->realloc(fvtxs, 0);
+    Y_Error("M_Load: Missing section %.4s", tag);
+    return NULL;
 }
 
 static patch_t *GetPatchById(map_t *map, uint8_t id) {
@@ -165,9 +194,9 @@ static patch_t *GetPatchById(map_t *map, uint8_t id) {
     // Check patch array.
     id -= 1;
     if (id >= map->numpatches) {
-        playdate->system->error("M_Load: Patch index %d is out of range", id);
+        Y_Error("M_Load: Patch index %d is out of range", id);
     }
-    return &map->patches[id];
+    return map->patches[id];
 }
 
 static flat_t *GetFlatById(map_t *map, uint8_t id) {
@@ -178,139 +207,402 @@ static flat_t *GetFlatById(map_t *map, uint8_t id) {
     // Check flat array.
     id -= 1;
     if (id >= map->numflats) {
-        playdate->system->error("M_Load: Flat index %d is out of range", id);
+        Y_Error("M_Load: Flat index %d is out of range", id);
     }
-    return &map->flats[id];
+    return map->flats[id];
 }
 
-static void LoadWalls(map_t *map) {
-    file_wall_t *fwalls = ReadMapFile("walls", &map->numwalls, sizeof(file_wall_t));
-    // Allocate walls.
-    map->walls = playdate->system->realloc(NULL, sizeof(wall_t) * map->numwalls);
-    // Convert walls. Not all data is validated until sectors are converted.
-    for (size_t i = 0; i < map->numwalls; i++) {
-        file_wall_t *fwall = &fwalls[i];
-        wall_t *wall = &map->walls[i];
-        // Check bounds of wall vertex.
-        if (fwall->vertex >= map->numvtxs) {
-            playdate->system->error("M_Load: Vertices of wall %d are out of bounds", i);
-        }
-        // Store vertex 1. Vertex 2 cannot be set until sectors are converted.
-        wall->v1 = &map->vtxs[fwall->vertex];
-        // Store the portal index directly into the portal pointer. The sector
-        // conversion routine will finish the conversion.
-        wall->portal = (void *) (uintptr_t) fwall->portal;
-        // Store the wall patches.
-        wall->toppatch = GetPatchById(map, fwall->textop);
-        wall->midpatch = GetPatchById(map, fwall->texmid);
-        wall->botpatch = GetPatchById(map, fwall->texbot);
-        // Store the wall's offsets.
-        wall->xoffset = fwall->xoffset;
-        wall->yoffset = fwall->yoffset;
+// Update a checksum with some bytes.
+static uint32_t UpdateChecksum(uint32_t checksum, const uint8_t *bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        checksum = (checksum ^ bytes[i]) * CHECKSUM_PRIME;
     }
-    // Free file data.
-    playdate->system->realloc(fwalls, 0);
+    return checksum;
 }
 
-static void LoadSectors(map_t *map) {
-    file_sector_t *fscts = ReadMapFile("sectors", &map->numscts, sizeof(file_sector_t));
-    // This error will be obsolete once actors are supported.
-    if (map->numscts == 0) {
-        playdate->system->error("Map has no sectors.");
+// Convert a wall. Not all data is validated until sectors are converted.
+static void LoadWall(map_t *map, const file_wall_t *fwall, size_t i, bool trusted) {
+    wall_t *wall = &map->walls[i];
+    // Check bounds of wall vertex.
+    if (!trusted && fwall->vertex >= map->numvtxs) {
+        Y_Error("M_Load: Vertices of wall %d are out of bounds", i);
     }
-    // Allocate sectors.
-    map->scts = playdate->system->realloc(NULL, sizeof(sector_t) * map->numscts);
-    // Convert sectors.
-    for (size_t i = 0; i < map->numscts; i++) {
-        file_sector_t *fsector = &fscts[i];
-        sector_t *sector = &map->scts[i];
+    // Store vertex 1. Vertex 2 cannot be set until sectors are converted.
+    wall->v1 = &map->vtxs[fwall->vertex];
+    // Store the portal index directly into the portal pointer. The sector
+    // conversion routine will finish the conversion.
+    wall->portal = (void *) (uintptr_t) fwall->portal;
+    // Store the wall patches.
+    wall->toppatch = GetPatchById(map, fwall->textop);
+    wall->midpatch = GetPatchById(map, fwall->texmid);
+    wall->botpatch = GetPatchById(map, fwall->texbot);
+    // Store the wall's offsets.
+    wall->xoffset = fwall->xoffset;
+    wall->yoffset = fwall->yoffset;
+}
+
+// Finish converting the walls of a trusted sector using precalculated data.
+static void LoadTrustedWalls(map_t *map, sector_t *sector, const file_wallcalc_t *wallcalcs, size_t i) {
+    for (size_t j = 0; j < sector->num_walls; j++) {
+        wall_t *wall = &sector->walls[j];
+        wall_t *next = &sector->walls[(j + 1) % sector->num_walls];
+        const file_wallcalc_t *calc = &wallcalcs[j];
+        wall->v2 = next->v1;
+        wall->delta = calc->delta;
+        wall->normal = calc->normal;
+        wall->length = calc->length;
+        size_t portalindex = (uintptr_t) wall->portal;
+        wall->portal = portalindex != i ? &map->scts[portalindex] : NULL;
+    }
+}
+
+// Validate and finish converting the walls of a sector, calculating the
+// derived data from scratch.
+static void LoadCheckedWalls(map_t *map, sector_t *sector, float *edge_a, float *edge_b, float *edge_c, size_t i) {
+    sector->bounds.min.x = INFINITY;
+    sector->bounds.min.y = INFINITY;
+    sector->bounds.max.x = -INFINITY;
+    sector->bounds.max.y = -INFINITY;
+    for (size_t j = 0; j < sector->num_walls; j++) {
+        wall_t *wall = &sector->walls[j];
+        wall_t *next = &sector->walls[(j + 1) % sector->num_walls];
+        wall->v2 = next->v1;
+        // Wall must have a nonzero length.
+        if (U_VecDistSq(wall->v1, wall->v2) == 0.0f) {
+            Y_Error("M_Load: Wall %d of sector %d has zero length", j, i);
+        }
+        // Precalculate delta.
+        U_VecCopy(&wall->delta, wall->v2);
+        U_VecSub(&wall->delta, wall->v1);
+        // Precalculate normal.
+        wall->normal.x = wall->delta.y;
+        wall->normal.y = -wall->delta.x;
+        U_VecNormalize(&wall->normal);
+        // Precalculate length.
+        wall->length = sqrtf(U_VecLenSq(&wall->delta));
+        // Precalculate line equation.
+        edge_a[j] = wall->normal.x;
+        edge_b[j] = wall->normal.y;
+        edge_c[j] = -U_VecDot(&wall->normal, wall->v1);
+        // Check for bounding box.
+        aabb_expand(&sector->bounds, wall->v1);
+        // Wall portal index must be within bounds.
+        size_t portalindex = (uintptr_t) wall->portal;
+        if (portalindex != i) {
+            if (portalindex >= map->numscts) {
+                Y_Error("M_Load: Portal index of wall %d of sector %d is out of bounds", j, i);
+            }
+            wall->portal = &map->scts[portalindex];
+        } else {
+            wall->portal = NULL;
+        }
+    }
+}
+
+// Convert a sector, and finish converting its walls.
+static void LoadSector(maploader_t *loader, size_t i) {
+    map_t *map = loader->map;
+    const file_sector_t *fsector = &loader->sectors[i];
+    sector_t *sector = &map->scts[i];
+    // Line equation arrays.
+    float *edge_a = &map->edges[0];
+    float *edge_b = &map->edges[map->numwalls];
+    float *edge_c = &map->edges[map->numwalls * 2];
+    if (!loader->trusted) {
         // Check that the sector is a polygon.
         if (fsector->num_walls < 3) {
-            playdate->system->error("M_Load: Sector %d is not a polygon", i);
+            Y_Error("M_Load: Sector %d is not a polygon", i);
         }
         if (fsector->ceiling <= fsector->floor) {
-            playdate->system->error("M_Load: Sector %d has non-positive vertical space", i);
+            Y_Error("M_Load: Sector %d has non-positive vertical space", i);
         }
-        sector->floor = fsector->floor;
-        sector->ceiling = fsector->ceiling;
         // Check that the wall slice is in bounds.
         size_t wstart = fsector->first_wall;
         size_t wend = wstart + fsector->num_walls;
         if (wend > map->numwalls) {
-            playdate->system->error("M_Load: Walls of sector %d are out of bounds", i);
+            Y_Error("M_Load: Walls of sector %d are out of bounds", i);
+        }
+    }
+    sector->floor = fsector->floor;
+    sector->ceiling = fsector->ceiling;
+    sector->light = fsector->light;
+    sector->walls = &map->walls[fsector->first_wall];
+    sector->num_walls = fsector->num_walls;
+    sector->edge_a = &edge_a[fsector->first_wall];
+    sector->edge_b = &edge_b[fsector->first_wall];
+    sector->edge_c = &edge_c[fsector->first_wall];
+    // Finish converting the walls, and find the bounding box.
+    if (loader->trusted) {
+        sector->bounds = loader->bounds[i];
+        LoadTrustedWalls(map, sector, &loader->wallcalcs[fsector->first_wall], i);
+    } else {
+        size_t k = fsector->first_wall;
+        LoadCheckedWalls(map, sector, &edge_a[k], &edge_b[k], &edge_c[k], i);
+    }
+    // Initialize iterator lists.
+    sector->next_seen = NULL;
+    sector->next_queue = NULL;
+    // Initialize actor list.
+    list_init(&sector->actors);
+    // Set flats.
+    sector->floorflat = GetFlatById(map, fsector->floorflat);
+    sector->ceilflat = GetFlatById(map, fsector->ceilflat);
+}
+
+// Open a map file and read its header, then allocate a single block holding
+// the map and its runtime arrays, and point the map into it. The file contents
+// get a separate allocation that only lasts until the map is loaded. The block
+// is ordered for locality during portal walks: sectors, walls, vertices, and
+// line equations, then the texture tables, which are only used when a sector
+// or wall is drawn. Textures are not part of the block, as they are shared
+// through the cache.
+static void OpenMap(maploader_t *loader, const char *name) {
+    playdate->system->formatString(&loader->path, "assets/maps/%s", name);
+    const char *path = loader->path;
+    size_t filesize;
+    SDFile *file = open_file(path, &filesize);
+    // Read the header and section table, to learn how much to allocate.
+    struct {
+        file_header_t header;
+        file_section_t sections[MAX_SECTIONS];
+    } head;
+    if (filesize < sizeof(file_header_t)) {
+        Y_Error("M_Load: Map header is missing");
+    }
+    read_file_part(file, &head.header, sizeof(file_header_t), path);
+    if (memcmp(head.header.magic, MAP_MAGIC, sizeof(head.header.magic)) != 0) {
+        Y_Error("M_Load: Not a map file");
+    }
+    if (head.header.version != MAP_VERSION) {
+        Y_Error("M_Load: Unsupported map version %d", head.header.version);
+    }
+    if (head.header.numsections > MAX_SECTIONS) {
+        Y_Error("M_Load: Too many sections");
+    }
+    size_t headsize = sizeof(file_header_t) + sizeof(file_section_t) * head.header.numsections;
+    if (filesize < headsize) {
+        Y_Error("M_Load: Section table is missing");
+    }
+    read_file_part(file, head.sections, headsize - sizeof(file_header_t), path);
+    // Find the element counts.
+    map_t counts;
+    size_t count;
+    const uint8_t *headbytes = (const uint8_t *) &head;
+    FindSection(headbytes, filesize, "VRTX", sizeof(vector_t), &counts.numvtxs);
+    FindSection(headbytes, filesize, "SECT", sizeof(file_sector_t), &counts.numscts);
+    FindSection(headbytes, filesize, "WALL", sizeof(file_wall_t), &counts.numwalls);
+    FindSection(headbytes, filesize, "PTCH", sizeof(char[8]), &counts.numpatches);
+    FindSection(headbytes, filesize, "FLAT", sizeof(char[8]), &counts.numflats);
+    FindSection(headbytes, filesize, "WCLC", sizeof(file_wallcalc_t), &count);
+    if (count != counts.numwalls) {
+        Y_Error("M_Load: Precalculated wall count mismatch");
+    }
+    FindSection(headbytes, filesize, "EDGE", sizeof(float) * 3, &count);
+    if (count != counts.numwalls) {
+        Y_Error("M_Load: Line equation count mismatch");
+    }
+    FindSection(headbytes, filesize, "BNDS", sizeof(aabb_t), &count);
+    if (count != counts.numscts) {
+        Y_Error("M_Load: Bounding box count mismatch");
+    }
+    // This error will be obsolete once actors are supported.
+    if (counts.numscts == 0) {
+        Y_Error("Map has no sectors.");
+    }
+    // Lay out the allocation.
+    size_t sctsoffset = ALIGN(sizeof(map_t));
+    size_t wallsoffset = sctsoffset + ALIGN(sizeof(sector_t) * counts.numscts);
+    size_t vtxsoffset = wallsoffset + ALIGN(sizeof(wall_t) * counts.numwalls);
+    size_t edgesoffset = vtxsoffset + ALIGN(sizeof(vector_t) * counts.numvtxs);
+    size_t patchesoffset = edgesoffset + ALIGN(sizeof(float) * 3 * counts.numwalls);
+    size_t flatsoffset = patchesoffset + ALIGN(sizeof(patch_t *) * counts.numpatches);
+    size_t totalsize = flatsoffset + sizeof(flat_t *) * counts.numflats;
+    uint8_t *base = Z_Malloc(totalsize, PU_LEVEL, NULL, ZS_MAP);
+    // The rest of the file is read after the header.
+    loader->file = file;
+    loader->blob = Z_Malloc(filesize, PU_STATIC, NULL, ZS_MAP);
+    loader->blobsize = filesize;
+    loader->index = headsize;
+    loader->checksum = head.header.checksum;
+    loader->readchecksum = CHECKSUM_BASIS;
+    memcpy(loader->blob, &head, headsize);
+    // Fix up pointers to the runtime arrays.
+    map_t *map = (map_t *) base;
+    *map = counts;
+    map->obj = NULL;
+    map->scts = (sector_t *) &base[sctsoffset];
+    map->walls = (wall_t *) &base[wallsoffset];
+    map->vtxs = (vector_t *) &base[vtxsoffset];
+    map->edges = (float *) &base[edgesoffset];
+    map->patches = (patch_t **) &base[patchesoffset];
+    map->flats = (flat_t **) &base[flatsoffset];
+    loader->map = map;
+}
+
+// Point the loader into the sections of the file contents, and copy the
+// sections the map keeps.
+static void FixupSections(maploader_t *loader) {
+    map_t *map = loader->map;
+    const uint8_t *blob = loader->blob;
+    size_t blobsize = loader->blobsize;
+    size_t count;
+    const void *section = FindSection(blob, blobsize, "VRTX", sizeof(vector_t), &count);
+    memcpy(map->vtxs, section, sizeof(vector_t) * count);
+    loader->sectors = FindSection(blob, blobsize, "SECT", sizeof(file_sector_t), &count);
+    loader->walls = FindSection(blob, blobsize, "WALL", sizeof(file_wall_t), &count);
+    loader->patches = FindSection(blob, blobsize, "PTCH", sizeof(char[8]), &count);
+    loader->flats = FindSection(blob, blobsize, "FLAT", sizeof(char[8]), &count);
+    loader->wallcalcs = FindSection(blob, blobsize, "WCLC", sizeof(file_wallcalc_t), &count);
+    loader->bounds = FindSection(blob, blobsize, "BNDS", sizeof(aabb_t), &count);
+    // If the map isn't trusted, the line equations are recalculated over
+    // this copy.
+    section = FindSection(blob, blobsize, "EDGE", sizeof(float) * 3, &count);
+    memcpy(map->edges, section, sizeof(float) * 3 * count);
+#ifdef MAP_ALWAYS_VALIDATE
+    loader->trusted = false;
+#else
+    loader->trusted = loader->readchecksum == loader->checksum;
+#endif
+}
+
+maploader_t *map_begin_load(const char *name) {
+    maploader_t *loader = Z_Malloc(sizeof(maploader_t), PU_STATIC, NULL, ZS_MAP);
+    memset(loader, 0, sizeof(maploader_t));
+    loader->name = Z_Malloc(strlen(name) + 1, PU_STATIC, NULL, ZS_MAP);
+    strcpy(loader->name, name);
+    loader->stage = LOAD_OPEN;
+    return loader;
+}
+
+bool map_load_step(maploader_t *loader) {
+    map_t *map = loader->map;
+    switch (loader->stage) {
+        case LOAD_OPEN:
+            OpenMap(loader, loader->name);
+            loader->stage = LOAD_READ;
+            break;
+        case LOAD_READ: {
+            // Read the next chunk of the file.
+            size_t chunk = loader->blobsize - loader->index;
+            if (chunk > LOAD_CHUNK_SIZE) {
+                chunk = LOAD_CHUNK_SIZE;
+            }
+            read_file_part(loader->file, &loader->blob[loader->index], chunk, loader->path);
+            loader->readchecksum = UpdateChecksum(loader->readchecksum, &loader->blob[loader->index], chunk);
+            loader->index += chunk;
+            if (loader->index == loader->blobsize) {
+                playdate->file->close(loader->file);
+                loader->file = NULL;
+                FixupSections(loader);
+                loader->index = 0;
+                loader->stage = LOAD_PATCHES;
+            }
+            break;
         }
-        // Finish converting the walls, and find the bounding box.
-        sector->walls = &map->walls[fsector->first_wall];
-        sector->num_walls = fsector->num_walls;
-        sector->bounds.min.x = INFINITY;
-        sector->bounds.min.y = INFINITY;
-        sector->bounds.max.x = -INFINITY;
-        sector->bounds.max.y = -INFINITY;
-        for (size_t j = 0; j < sector->num_walls; j++) {
-            wall_t *wall = &sector->walls[j];
-            wall_t *next = &sector->walls[(j + 1) % sector->num_walls];
-            wall->v2 = next->v1;
-            // Wall must have a nonzero length.
-            if (U_VecDistSq(wall->v1, wall->v2) == 0.0f) {
-                playdate->system->error("M_Load: Wall %d of sector %d has zero length", j, i);
+        case LOAD_PATCHES:
+            // Each 8 bytes is a patch name.
+            if (loader->index < map->numpatches) {
+                map->patches[loader->index] = W_CachePatch(&loader->patches[8 * loader->index]);
+                ++loader->index;
+            } else {
+                loader->index = 0;
+                loader->stage = LOAD_FLATS;
             }
-            // Precalculate delta.
-            U_VecCopy(&wall->delta, wall->v2);
-            U_VecSub(&wall->delta, wall->v1);
-            // Precalculate normal.
-            wall->normal.x = wall->delta.y;
-            wall->normal.y = -wall->delta.x;
-            U_VecNormalize(&wall->normal);
-            // Precalculate length.
-            wall->length = sqrtf(U_VecLenSq(&wall->delta));
-            // Check for bounding box.
-            aabb_expand(&sector->bounds, wall->v1);
-            // Wall portal index must be within bounds.
-            size_t portalindex = (uintptr_t) wall->portal;
-            if (portalindex != i) {
-                if (portalindex >= map->numscts) {
-                    playdate->system->error("M_Load: Portal index of wall %d of sector %d is out of bounds", j, i);
-                }
-                wall->portal = &map->scts[portalindex];
+            break;
+        case LOAD_FLATS:
+            // Each 8 bytes is a flat name.
+            if (loader->index < map->numflats) {
+                map->flats[loader->index] = W_CacheFlat(&loader->flats[8 * loader->index]);
+                ++loader->index;
             } else {
-                wall->portal = NULL;
+                loader->index = 0;
+                loader->stage = LOAD_WALLS;
+            }
+            break;
+        case LOAD_WALLS:
+            for (uint8_t i = 0; i < LOAD_BATCH_SIZE && loader->index < map->numwalls; i++) {
+                LoadWall(map, &loader->walls[loader->index], loader->index, loader->trusted);
+                ++loader->index;
+            }
+            if (loader->index == map->numwalls) {
+                loader->index = 0;
+                loader->stage = LOAD_SECTORS;
             }
+            break;
+        case LOAD_SECTORS:
+            for (uint8_t i = 0; i < LOAD_BATCH_SIZE && loader->index < map->numscts; i++) {
+                LoadSector(loader, loader->index);
+                ++loader->index;
+            }
+            if (loader->index == map->numscts) {
+                // Everything needed from the file has been converted.
+                Z_Free(loader->blob);
+                loader->blob = NULL;
+                loader->stage = LOAD_DONE;
+            }
+            break;
+        case LOAD_DONE:
+            break;
+    }
+    return loader->stage == LOAD_DONE;
+}
+
+bool map_load_done(const maploader_t *loader) {
+    return loader->stage == LOAD_DONE;
+}
+
+map_t *map_finish_load(maploader_t *loader) {
+    while (!map_load_step(loader));
+    map_t *map = loader->map;
+    loader->map = NULL;
+    return map;
+}
+
+void map_free_loader(maploader_t *loader) {
+    if (loader->file != NULL) {
+        playdate->file->close(loader->file);
+    }
+    map_t *map = loader->map;
+    if (map != NULL) {
+        // Release the textures referenced so far.
+        size_t numpatches = 0;
+        size_t numflats = 0;
+        if (loader->stage == LOAD_PATCHES) {
+            numpatches = loader->index;
+        } else if (loader->stage > LOAD_PATCHES) {
+            numpatches = map->numpatches;
+            numflats = loader->stage == LOAD_FLATS ? loader->index : map->numflats;
+        }
+        for (size_t i = 0; i < numpatches; i++) {
+            W_ReleasePatch(map->patches[i]);
+        }
+        for (size_t i = 0; i < numflats; i++) {
+            W_ReleaseFlat(map->flats[i]);
         }
-        // Initialize iterator lists.
-        sector->next_seen = NULL;
-        sector->next_queue = NULL;
-        // Initialize actor list.
-        list_init(&sector->actors);
-        // Set flats.
-        sector->floorflat = GetFlatById(map, fsector->floorflat);
-        sector->ceilflat = GetFlatById(map, fsector->ceilflat);
+        Z_Free(map);
     }
-    // Free file data.
-    playdate->system->realloc(fscts, 0);
+    Z_Free(loader->blob);
+    // The path comes from formatString, so it belongs to the system.
+    playdate->system->realloc(loader->path, 0);
+    Z_Free(loader->name);
+    Z_Free(loader);
 }
 
 map_t *map_load(const char *name) {
-    // Allocate map.
-    map_t *map = playdate->system->realloc(NULL, sizeof(map_t));
-    mapname = name;
-    // Load the textures.
-    LoadPatches(map);
-    LoadFlats(map);
-    // Load each part of the map.
-    LoadVertices(map);
-    LoadWalls(map);
-    LoadSectors(map);
+    maploader_t *loader = map_begin_load(name);
+    map_t *map = map_finish_load(loader);
+    map_free_loader(loader);
     return map;
 }
 
 void map_free(map_t *map) {
-    playdate->system->realloc(map->vtxs, 0);
-    playdate->system->realloc(map->walls, 0);
-    playdate->system->realloc(map->scts, 0);
+    // Release the textures.
     for (size_t i = 0; i < map->numpatches; i++) {
-        playdate->system->realloc(map->patches[i].data, 0);
+        W_ReleasePatch(map->patches[i]);
+    }
+    for (size_t i = 0; i < map->numflats; i++) {
+        W_ReleaseFlat(map->flats[i]);
     }
-    playdate->system->realloc(map->patches, 0);
-    playdate->system->realloc(map->flats, 0);
-    playdate->system->realloc(map, 0);
+    // Everything else lives in the map's allocation.
+    Z_Free(map);
 }
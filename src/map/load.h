@@ -3,9 +3,30 @@
 
 #include "map/defs.h"
 
+// State of a map being loaded incrementally.
+typedef struct maploader_s maploader_t;
+
 // Loads a map from /maps/$name.
 map_t *map_load(const char *name);
 
+// Begin loading a map from /maps/$name incrementally. No work is done until
+// the loader is stepped.
+maploader_t *map_begin_load(const char *name);
+
+// Do a small, bounded amount of loading work. Returns true once the map is
+// fully loaded.
+bool map_load_step(maploader_t *loader);
+
+// Return true if the map is fully loaded.
+bool map_load_done(const maploader_t *loader);
+
+// Finish loading and take ownership of the map, or return NULL if the map was
+// already taken. The loader must still be freed.
+map_t *map_finish_load(maploader_t *loader);
+
+// Free a loader, along with its map if it was not taken.
+void map_free_loader(maploader_t *loader);
+
 // Frees a map.
 void map_free(map_t *map);
 
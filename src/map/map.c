@@ -1,50 +1,71 @@
+#include "profile.h"
 #include "system.h"
+#include "zone.h"
 #include "map/iter.h"
 #include "map/load.h"
 #include "map/map.h"
 #include "util/vec.h"
 
 #include <math.h>
+#include <string.h>
 
 // Height of object when colliding with ceilings.
 #define OBJECT_HEIGHT 56.0f
 
 static float WallPointDist(const wall_t *wall, const vector_t *point) {
-    return (wall->v2->y - wall->v1->y) * (point->x - wall->v1->x) -
-        (wall->v2->x - wall->v1->x) * (point->y - wall->v1->y);
+    return wall->delta.y * (point->x - wall->v1->x) -
+        wall->delta.x * (point->y - wall->v1->y);
 }
 
 bool M_PointInFrontOfWall(const wall_t *wall, const vector_t *point) {
     return WallPointDist(wall, point) >= 0.0f;
 }
 
-bool M_SectorContainsPoint(const sector_t *sector, const vector_t *point) {
-    for (size_t i = 0; i < sector->num_walls; i++) {
-        const wall_t *wall = &sector->walls[i];
-        // Test if point lies in front of line.
-        if (!M_PointInFrontOfWall(wall, point)) {
+// Distance from a point to edge i of a sector.
+#define EDGEDIST(_i_) fmaf(a[_i_], x, fmaf(b[_i_], y, c[_i_]))
+
+// Return true if the point is at least the given distance in front of every
+// edge of the sector. Edges are tested four at a time without branching, so
+// that only one early-out check is paid per block of edges.
+static bool SectorEdgesAbove(const sector_t *sector, const vector_t *point, float limit) {
+    const float *a = sector->edge_a;
+    const float *b = sector->edge_b;
+    const float *c = sector->edge_c;
+    float x = point->x;
+    float y = point->y;
+    size_t n = sector->num_walls;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        bool outside =
+            (EDGEDIST(i + 0) < limit) |
+            (EDGEDIST(i + 1) < limit) |
+            (EDGEDIST(i + 2) < limit) |
+            (EDGEDIST(i + 3) < limit);
+        if (outside) {
             return false;
         }
     }
-    return true;
-}
-
-bool M_SectorContainsCircle(const sector_t *sector, const vector_t *point, float radius) {
-    for (size_t i = 0; i < sector->num_walls; i++) {
-        const wall_t *wall = &sector->walls[i];
-        // Test if circle lies in front of line.
-        if (WallPointDist(wall, point) < -radius * wall->length) {
+    for (; i < n; i++) {
+        if (EDGEDIST(i) < limit) {
             return false;
         }
     }
     return true;
 }
 
-static sector_t *FindPlayerSector(sector_t *sector, const vector_t *point) {
+bool M_SectorContainsPoint(const sector_t *sector, const vector_t *point) {
+    return SectorEdgesAbove(sector, point, 0.0f);
+}
+
+bool M_SectorContainsCircle(const sector_t *sector, const vector_t *point, float radius) {
+    return SectorEdgesAbove(sector, point, -radius);
+}
+
+sector_t *M_FindSector(sector_t *sector, const vector_t *point) {
     sector_t *root = sector;
     sector_iter_init(sector);
 
-    // Iterate until we find a sector that contains the player in its walls.
+    // Iterate until we find a sector that contains the point in its walls.
     while ((sector = sector_iter_pop())) {
         if (M_SectorContainsPoint(sector, point)) {
             // This sector contains our point.
@@ -61,8 +82,8 @@ static sector_t *FindPlayerSector(sector_t *sector, const vector_t *point) {
         }
     }
 
-    // Somehow the player isn't in any sector. As a failsafe, we'll return the
-    // sector they were last seen in.
+    // Somehow the point isn't in any sector. As a failsafe, we'll return the
+    // sector we started in.
     sector_iter_cleanup();
     return root;
 }
@@ -205,6 +226,7 @@ static const wall_t *SectorCollide(
 }
 
 void M_MoveAndSlide(actor_t *actor) {
+    PROF_BEGIN(PROF_MOVE);
     // Only allow so many sector changes.
     uint8_t changes_left = 5;
     while (changes_left-- && U_VecLenSq(&actor->vel) > 0.001f) {
@@ -229,6 +251,266 @@ void M_MoveAndSlide(actor_t *actor) {
         actor->vel.x = 0.0f;
         actor->vel.y = 0.0f;
     }
+    PROF_END(PROF_MOVE);
+}
+
+// How far apart, as a fraction of the ray, wall crossings can be and still be
+// treated as the same point.
+#define RAY_TIE 1e-5f
+
+// Test if a ray crosses a wall's segment, rather than only its line, at t.
+static bool RayCrossesWall(const wall_t *wall, const vector_t *start, const vector_t *delta, float t) {
+    vector_t d;
+    U_VecCopy(&d, start);
+    U_VecScaledAdd(&d, delta, t);
+    U_VecSub(&d, wall->v1);
+    float along = U_VecDot(&d, &wall->delta);
+    float slack = wall->length * wall->length * RAY_TIE;
+    return along >= -slack && along <= wall->length * wall->length + slack;
+}
+
+// Find the earliest point after tmin at which a ray hits an actor linked to a
+// sector, closer than the actor already found, if any.
+static actor_t *RayActorInSector(
+    const sector_t *sector,
+    const vector_t *start,
+    float zstart,
+    const vector_t *delta,
+    float dz,
+    float tmin,
+    float *tmax,
+    const actor_t *ignore,
+    actor_t *result
+) {
+    float qa = U_VecLenSq(delta);
+    listiter_t iter;
+    listiter_init(&iter, &sector->actors);
+    actor_t *actor;
+    while ((actor = (actor_t *) listiter_next(&iter))) {
+        if (actor == ignore) {
+            continue;
+        }
+        // Solve for where the ray enters and leaves the actor's radius.
+        vector_t d;
+        U_VecCopy(&d, start);
+        U_VecSub(&d, &actor->pos);
+        float qb = U_VecDot(&d, delta);
+        float qc = U_VecLenSq(&d) - (OBJ_RADIUS * OBJ_RADIUS);
+        float disc = qb * qb - qa * qc;
+        if (disc < 0.0f) {
+            continue;
+        }
+        float root = sqrtf(disc);
+        float t = (-qb - root) / qa;
+        if (t < tmin) {
+            // The ray is inside the actor at tmin unless it already left.
+            if ((-qb + root) / qa < tmin) {
+                continue;
+            }
+            t = tmin;
+        }
+        if (t >= *tmax) {
+            continue;
+        }
+        // Check the vertical extent of the actor.
+        float z = fmaf(dz, t, zstart);
+        if (z < actor->zpos || z > actor->zpos + OBJECT_HEIGHT) {
+            continue;
+        }
+        result = actor;
+        *tmax = t;
+    }
+    return result;
+}
+
+// Find the earliest point after tmin at which a ray hits an actor in a sector.
+// Actors near a wall may be linked to the sector on the other side while still
+// overlapping this one, so the actors of neighbouring sectors are tested too.
+static actor_t *RayActor(
+    const sector_t *sector,
+    const vector_t *start,
+    float zstart,
+    const vector_t *delta,
+    float dz,
+    float tmin,
+    float *tmax,
+    const actor_t *ignore
+) {
+    if (U_VecLenSq(delta) == 0.0f) {
+        return NULL;
+    }
+    actor_t *result = RayActorInSector(sector, start, zstart, delta, dz, tmin, tmax, ignore, NULL);
+    for (size_t i = 0; i < sector->num_walls; i++) {
+        const sector_t *portal = sector->walls[i].portal;
+        if (portal != NULL) {
+            result = RayActorInSector(portal, start, zstart, delta, dz, tmin, tmax, ignore, result);
+        }
+    }
+    return result;
+}
+
+bool M_Raycast(
+    sector_t *sector,
+    const vector_t *start,
+    float zstart,
+    const vector_t *end,
+    float zend,
+    const actor_t *ignore,
+    rayhit_t *hit
+) {
+    vector_t delta;
+    U_VecCopy(&delta, end);
+    U_VecSub(&delta, start);
+    float dz = zend - zstart;
+    // Where the ray entered the current sector.
+    float tenter = 0.0f;
+
+    hit->type = RAY_NONE;
+    hit->wall = NULL;
+    hit->actor = NULL;
+
+    for (uint8_t steps = 0; steps < MAX_RAY_SECTORS; steps++) {
+        // Find the wall the ray leaves this sector through. As the sector is
+        // convex, this is the nearest wall the ray crosses from front to back.
+        // Collinear walls are crossed at the same point, so of those, take
+        // the one whose segment contains it.
+        const wall_t *exitwall = NULL;
+        float texit = 1.0f;
+        for (size_t i = 0; i < sector->num_walls; i++) {
+            float d1 = fmaf(sector->edge_a[i], start->x,
+                fmaf(sector->edge_b[i], start->y, sector->edge_c[i]));
+            float dd = sector->edge_a[i] * delta.x + sector->edge_b[i] * delta.y;
+            if (dd >= 0.0f) {
+                continue;
+            }
+            float t = d1 / -dd;
+            if (t < texit - RAY_TIE || (t <= texit + RAY_TIE &&
+                    RayCrossesWall(&sector->walls[i], start, &delta, t))) {
+                exitwall = &sector->walls[i];
+                texit = t;
+            }
+        }
+        if (texit < tenter) {
+            texit = tenter;
+        }
+        // Check for hitting the floor or ceiling before leaving.
+        raytype_t type = RAY_NONE;
+        float tend = texit;
+        if (dz < 0.0f) {
+            float t = (sector->floor - zstart) / dz;
+            if (t < tend) {
+                type = RAY_FLOOR;
+                tend = t;
+            }
+        } else if (dz > 0.0f) {
+            float t = (sector->ceiling - zstart) / dz;
+            if (t < tend) {
+                type = RAY_CEILING;
+                tend = t;
+            }
+        }
+        // Check for hitting an actor before anything else.
+        actor_t *actor = RayActor(sector, start, zstart, &delta, dz, tenter, &tend, ignore);
+        if (actor != NULL) {
+            type = RAY_ACTOR;
+            hit->actor = actor;
+        } else if (type == RAY_NONE && exitwall != NULL) {
+            // The ray leaves the sector. Pass through if it fits the portal.
+            float z = fmaf(dz, texit, zstart);
+            const sector_t *portal = exitwall->portal;
+            if (portal == NULL || z <= portal->floor || z >= portal->ceiling) {
+                type = RAY_WALL;
+                hit->wall = exitwall;
+            } else {
+                sector = exitwall->portal;
+                tenter = texit;
+                continue;
+            }
+        }
+        if (type == RAY_NONE) {
+            // The ray ended inside this sector.
+            return false;
+        }
+        hit->type = type;
+        hit->frac = tend;
+        U_VecCopy(&hit->pos, start);
+        U_VecScaledAdd(&hit->pos, &delta, tend);
+        hit->zpos = fmaf(dz, tend, zstart);
+        hit->sector = sector;
+        return true;
+    }
+    // Too many sectors crossed. Treat it as a miss.
+    return false;
+}
+
+void M_SaveActorStates(map_t *map) {
+    for (size_t i = 0; i < map->numscts; i++) {
+        listiter_t iter;
+        listiter_init(&iter, &map->scts[i].actors);
+        actor_t *actor;
+        while ((actor = (actor_t *) listiter_next(&iter))) {
+            actor_save_state(actor);
+        }
+    }
+}
+
+// Visit all actors in sectors overlapping a box, with an optional radius check.
+static void ActorsInBounds(
+    sector_t *sector,
+    const aabb_t *box,
+    const vector_t *center,
+    float radiussq,
+    actorquery_t callback,
+    void *userdata
+) {
+    sector_iter_init(sector);
+
+    while ((sector = sector_iter_pop()) != NULL) {
+        // Filter the actors in this sector.
+        listiter_t iter;
+        listiter_init(&iter, &sector->actors);
+        actor_t *actor;
+        while ((actor = (actor_t *) listiter_next(&iter))) {
+            const vector_t *pos = &actor->pos;
+            if (pos->x < box->min.x || pos->x > box->max.x ||
+                pos->y < box->min.y || pos->y > box->max.y) {
+                continue;
+            }
+            if (center != NULL && U_VecDistSq(center, pos) > radiussq) {
+                continue;
+            }
+            callback(actor, userdata);
+        }
+
+        // Follow portals to sectors that overlap the box.
+        for (size_t i = 0; i < sector->num_walls; i++) {
+            const wall_t *wall = &sector->walls[i];
+            if (wall->portal != NULL && aabb_overlap(box, &wall->portal->bounds)) {
+                sector_iter_push(wall->portal);
+            }
+        }
+    }
+
+    sector_iter_cleanup();
+}
+
+void M_ActorsInBox(sector_t *sector, const aabb_t *box, actorquery_t callback, void *userdata) {
+    ActorsInBounds(sector, box, NULL, 0.0f, callback, userdata);
+}
+
+void M_ActorsInRadius(
+    sector_t *sector,
+    const vector_t *center,
+    float radius,
+    actorquery_t callback,
+    void *userdata
+) {
+    aabb_t box;
+    box.min.x = center->x - radius;
+    box.min.y = center->y - radius;
+    box.max.x = center->x + radius;
+    box.max.y = center->y + radius;
+    ActorsInBounds(sector, &box, center, radius * radius, callback, userdata);
 }
 
 static map_t *get_map_pointer(void) {
@@ -248,6 +530,147 @@ static int func_spawn(lua_State *L) {
     return 1;
 }
 
+// Get the optional actor argument at the given position, or NULL if absent.
+static actor_t *GetOptionalActor(int pos) {
+    if (playdate->lua->getArgCount() < pos || playdate->lua->argIsNil(pos)) {
+        return NULL;
+    }
+    return playdate->lua->getArgObject(pos, ACTOR_CLASS, NULL);
+}
+
+static int func_raycast(lua_State *L) {
+    map_t *map = get_map_pointer();
+
+    vector_t start, end;
+    start.x = playdate->lua->getArgFloat(2);
+    start.y = playdate->lua->getArgFloat(3);
+    float zstart = playdate->lua->getArgFloat(4);
+    end.x = playdate->lua->getArgFloat(5);
+    end.y = playdate->lua->getArgFloat(6);
+    float zend = playdate->lua->getArgFloat(7);
+
+    // An optional actor to cast from. It is used to find the starting sector
+    // quickly, and is never hit by its own ray.
+    actor_t *from = GetOptionalActor(8);
+    sector_t *sector = M_FindSector(from != NULL ? from->sector : &map->scts[0], &start);
+
+    rayhit_t hit;
+    if (!M_Raycast(sector, &start, zstart, &end, zend, from, &hit)) {
+        playdate->lua->pushNil();
+        return 1;
+    }
+
+    static const char *const hitnames[] = {
+        [RAY_WALL]    = "wall",
+        [RAY_FLOOR]   = "floor",
+        [RAY_CEILING] = "ceiling",
+        [RAY_ACTOR]   = "actor",
+    };
+    playdate->lua->pushString(hitnames[hit.type]);
+    playdate->lua->pushFloat(hit.pos.x);
+    playdate->lua->pushFloat(hit.pos.y);
+    playdate->lua->pushFloat(hit.zpos);
+    if (hit.type == RAY_ACTOR) {
+        playdate->lua->pushInt(hit.actor->id);
+        return 5;
+    }
+    return 4;
+}
+
+// Room for actor IDs to start with.
+#define MINLISTACTORS 16
+
+// IDs of the actors found by the last query. Lua reads them through a list
+// object, since a crowded query could overflow the Lua stack if they were
+// returned one by one.
+typedef struct {
+    int32_t *ids;
+    // Number of IDs in the list.
+    size_t count;
+    // Number of IDs there is room for. It only grows, so that queries do not
+    // allocate every time.
+    size_t max;
+} actorlist_t;
+
+static actorlist_t actorlist;
+
+// Add the ID of a queried actor to the list.
+static void AddActorId(actor_t *actor, void *userdata) {
+    actorlist_t *list = userdata;
+    if (list->count == list->max) {
+        // Double the room for IDs.
+        size_t newmax = list->max != 0 ? list->max * 2 : MINLISTACTORS;
+        int32_t *newids = Z_Malloc(sizeof(int32_t) * newmax, PU_STATIC, NULL, ZS_ACTOR);
+        if (list->ids != NULL) {
+            memcpy(newids, list->ids, sizeof(int32_t) * list->count);
+            Z_Free(list->ids);
+        }
+        list->ids = newids;
+        list->max = newmax;
+    }
+    list->ids[list->count++] = actor->id;
+}
+
+static int func_actorsInRadius(lua_State *L) {
+    map_t *map = get_map_pointer();
+
+    vector_t center;
+    center.x = playdate->lua->getArgFloat(2);
+    center.y = playdate->lua->getArgFloat(3);
+    float radius = playdate->lua->getArgFloat(4);
+    actor_t *from = GetOptionalActor(5);
+    sector_t *sector = M_FindSector(from != NULL ? from->sector : &map->scts[0], &center);
+
+    actorlist.count = 0;
+    M_ActorsInRadius(sector, &center, radius, AddActorId, &actorlist);
+    playdate->lua->pushObject(&actorlist, ACTORLIST_CLASS, 0);
+    return 1;
+}
+
+static int func_actorsInBox(lua_State *L) {
+    map_t *map = get_map_pointer();
+
+    aabb_t box;
+    box.min.x = playdate->lua->getArgFloat(2);
+    box.min.y = playdate->lua->getArgFloat(3);
+    box.max.x = playdate->lua->getArgFloat(4);
+    box.max.y = playdate->lua->getArgFloat(5);
+    actor_t *from = GetOptionalActor(6);
+    vector_t center;
+    center.x = (box.min.x + box.max.x) * 0.5f;
+    center.y = (box.min.y + box.max.y) * 0.5f;
+    sector_t *sector = M_FindSector(from != NULL ? from->sector : &map->scts[0], &center);
+
+    actorlist.count = 0;
+    M_ActorsInBox(sector, &box, AddActorId, &actorlist);
+    playdate->lua->pushObject(&actorlist, ACTORLIST_CLASS, 0);
+    return 1;
+}
+
+static int func_actorlist_count(lua_State *L) {
+    const actorlist_t *list = playdate->lua->getArgObject(1, ACTORLIST_CLASS, NULL);
+    playdate->lua->pushInt(list->count);
+    return 1;
+}
+
+static int func_actorlist_get(lua_State *L) {
+    const actorlist_t *list = playdate->lua->getArgObject(1, ACTORLIST_CLASS, NULL);
+    // Lists are indexed from 1, as Lua tables are.
+    int index = playdate->lua->getArgInt(2);
+    if (index < 1 || (size_t) index > list->count) {
+        playdate->lua->pushNil();
+    } else {
+        playdate->lua->pushInt(list->ids[index - 1]);
+    }
+    return 1;
+}
+
+static lua_reg actorlist_regs[] = {
+    { "count", func_actorlist_count },
+    { "get",   func_actorlist_get },
+    { NULL, NULL },
+};
+
 static int func_free(lua_State *L) {
     map_t *map = get_map_pointer();
     map_free(map);
@@ -255,11 +678,68 @@ static int func_free(lua_State *L) {
 }
 
 static lua_reg map_regs[] = {
-    { "spawn", func_spawn },
-    { "free",  func_free },
+    { "spawn",          func_spawn },
+    { "raycast",        func_raycast },
+    { "actorsInRadius", func_actorsInRadius },
+    { "actorsInBox",    func_actorsInBox },
+    { "free",           func_free },
     { NULL, NULL },
 };
 
+static maploader_t *get_loader_pointer(void) {
+    return playdate->lua->getArgObject(1, MAPLOADER_CLASS, NULL);
+}
+
+static int func_loader_step(lua_State *L) {
+    maploader_t *loader = get_loader_pointer();
+    uint32_t budget = playdate->lua->getArgInt(2);
+    // Always make some progress, then continue until out of time.
+    uint32_t start = playdate->system->getCurrentTimeMilliseconds();
+    while (!map_load_step(loader) &&
+        playdate->system->getCurrentTimeMilliseconds() - start < budget);
+    playdate->lua->pushBool(map_load_done(loader));
+    return 1;
+}
+
+static int func_loader_done(lua_State *L) {
+    maploader_t *loader = get_loader_pointer();
+    playdate->lua->pushBool(map_load_done(loader));
+    return 1;
+}
+
+static int func_loader_getMap(lua_State *L) {
+    maploader_t *loader = get_loader_pointer();
+    map_t *map = map_finish_load(loader);
+    if (map == NULL) {
+        // Map was already taken.
+        playdate->lua->pushNil();
+    } else {
+        playdate->lua->pushObject(map, MAP_CLASS, 0);
+    }
+    return 1;
+}
+
+static int func_loader_free(lua_State *L) {
+    maploader_t *loader = get_loader_pointer();
+    map_free_loader(loader);
+    return 0;
+}
+
+static lua_reg maploader_regs[] = {
+    { "step",   func_loader_step },
+    { "done",   func_loader_done },
+    { "getMap", func_loader_getMap },
+    { "free",   func_loader_free },
+    { NULL, NULL },
+};
+
+static int func_beginLoad(lua_State *L) {
+    const char *name = playdate->lua->getArgString(1);
+    maploader_t *loader = map_begin_load(name);
+    playdate->lua->pushObject(loader, MAPLOADER_CLASS, 0);
+    return 1;
+}
+
 static int func_load(lua_State *L) {
     const char *name = playdate->lua->getArgString(1);
     map_t *map = map_load(name);
@@ -269,5 +749,8 @@ static int func_load(lua_State *L) {
 
 void register_map_class(void) {
     playdate->lua->registerClass(MAP_CLASS, map_regs, NULL, 0, NULL);
+    playdate->lua->registerClass(MAPLOADER_CLASS, maploader_regs, NULL, 0, NULL);
+    playdate->lua->registerClass(ACTORLIST_CLASS, actorlist_regs, NULL, 0, NULL);
     playdate->lua->addFunction(func_load, "brute.map.load", NULL);
+    playdate->lua->addFunction(func_beginLoad, "brute.map.beginLoad", NULL);
 }
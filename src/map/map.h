@@ -10,8 +10,62 @@
 
 #define MAP_CLASS "brute.classes.map"
 
+#define MAPLOADER_CLASS "brute.classes.maploader"
+
+#define ACTORLIST_CLASS "brute.classes.actorlist"
+
+// Maximum number of sectors a ray may pass through.
+#define MAX_RAY_SECTORS 64
+
+// What a ray cast hit.
+typedef enum {
+    RAY_NONE,    // The ray reached its end without hitting anything.
+    RAY_WALL,    // The ray hit a wall, or the upper or lower part of a portal.
+    RAY_FLOOR,   // The ray hit the floor of a sector.
+    RAY_CEILING, // The ray hit the ceiling of a sector.
+    RAY_ACTOR,   // The ray hit an actor.
+} raytype_t;
+
+// The result of a ray cast.
+typedef struct {
+    // What was hit.
+    raytype_t type;
+    // How far along the ray the hit occurred, from 0 to 1.
+    float frac;
+    // The horizontal position of the hit.
+    vector_t pos;
+    // The vertical position of the hit.
+    float zpos;
+    // The sector the hit occurred in.
+    sector_t *sector;
+    // The wall that was hit, if type is RAY_WALL.
+    const wall_t *wall;
+    // The actor that was hit, if type is RAY_ACTOR.
+    actor_t *actor;
+} rayhit_t;
+
 void M_MoveAndSlide(actor_t *actor);
 
+// Find the sector containing a point, searching outward from the given sector.
+// If no sector contains the point, the given sector is returned.
+sector_t *M_FindSector(sector_t *sector, const vector_t *point);
+
+// Cast a ray from start to end through the portals of the map, beginning in
+// the given sector, which should contain the start point. Only the sectors the
+// ray passes through are visited. Actors are hit if they are linked to one of
+// those sectors or a sector sharing a portal with one, so an actor overlapping
+// a sector further away than that is missed. The ignored actor, if not NULL,
+// is never hit. Returns true if something was hit.
+bool M_Raycast(
+    sector_t *sector,
+    const vector_t *start,
+    float zstart,
+    const vector_t *end,
+    float zend,
+    const actor_t *ignore,
+    rayhit_t *hit
+);
+
 // Test if a point is in front of a wall.
 bool M_PointInFrontOfWall(const wall_t *wall, const vector_t *point);
 
@@ -21,6 +75,30 @@ bool M_SectorContainsPoint(const sector_t *sector, const vector_t *point);
 // Test if a circle is within a sector.
 bool M_SectorContainsCircle(const sector_t *sector, const vector_t *point, float radius);
 
+// Save the state of every actor in the map for interpolation. Call at the
+// start of every tic.
+void M_SaveActorStates(map_t *map);
+
+// Callback for actor queries. Must not start another sector iteration.
+typedef void (*actorquery_t)(actor_t *actor, void *userdata);
+
+// Call the callback for every actor whose position lies within the box,
+// searching outward from the given sector, which should contain a point in the
+// box. Only sectors connected through portals whose bounds overlap the box are
+// visited.
+void M_ActorsInBox(sector_t *sector, const aabb_t *box, actorquery_t callback, void *userdata);
+
+// Call the callback for every actor whose position lies within the radius of
+// a point, searching outward from the given sector, which should contain the
+// point.
+void M_ActorsInRadius(
+    sector_t *sector,
+    const vector_t *center,
+    float radius,
+    actorquery_t callback,
+    void *userdata
+);
+
 void register_map_class(void);
 
 #endif
@@ -1,9 +1,17 @@
+#include "log.h"
+#include "profile.h"
 #include "system.h"
+#include "tic.h"
 #include "video.h"
+#include "zone.h"
 #include "actor/actor.h"
+#include "asset/texture.h"
 #include "map/map.h"
 #include "render/draw.h"
 #include "render/main.h"
+#include "render/thread.h"
+
+#include <string.h>
 
 PlaydateAPI *playdate;
 
@@ -22,9 +30,121 @@ static int quit(lua_State *L) {
 
 static int render_draw(lua_State *L) {
     actor_t *actor = get_actor_pointer();
+    PROF_END(PROF_LUA);
     R_LoadFramebuffer();
     render_viewpoint(actor);
+    PROF_OVERLAY();
     R_FlushFramebuffer();
+    // Load textures that were missing this frame.
+    W_LoadPendingTextures();
+    // Start counting the allocations of the next frame.
+    Z_EndFrame();
+    // Write out what was logged this frame.
+    Y_Flush();
+    return 0;
+}
+
+static int render_stats(lua_State *L) {
+    renderstats_t stats;
+    R_GetRenderStats(&stats);
+    playdate->lua->pushInt(stats.sectors);
+    playdate->lua->pushInt(stats.walls);
+    playdate->lua->pushInt(stats.columns);
+    playdate->lua->pushInt(stats.spans);
+    playdate->lua->pushInt(stats.actors);
+    return 5;
+}
+
+static int render_strips(lua_State *L) {
+    // Change the number of strips if asked to.
+    if (playdate->lua->getArgCount() >= 1 && !playdate->lua->argIsNil(1)) {
+        R_SetStrips(playdate->lua->getArgInt(1));
+    }
+    playdate->lua->pushInt(R_GetStrips());
+    return 1;
+}
+
+static int render_threads(lua_State *L) {
+    // Change the number of threads if asked to.
+    if (playdate->lua->getArgCount() >= 1 && !playdate->lua->argIsNil(1)) {
+        R_SetRenderThreads(playdate->lua->getArgInt(1));
+    }
+    playdate->lua->pushInt(R_GetRenderThreads());
+    return 1;
+}
+
+#ifdef PROFILE
+static int profile(lua_State *L) {
+    // Show or hide the overlay if asked to.
+    if (playdate->lua->getArgCount() >= 1 && !playdate->lua->argIsNil(1)) {
+        B_ProfileShowOverlay(playdate->lua->getArgBool(1));
+    }
+    uint32_t averages[NUMPROFSTAGES + 1];
+    B_ProfileAverages(averages);
+    for (int i = 0; i <= NUMPROFSTAGES; i++) {
+        playdate->lua->pushInt(averages[i]);
+    }
+    return NUMPROFSTAGES + 1;
+}
+#endif
+
+#ifdef ZONE_TRACKING
+static int memory_stats(lua_State *L) {
+    if (playdate->lua->getArgCount() >= 1 && !playdate->lua->argIsNil(1)) {
+        // Get the statistics of the subsystem with this name.
+        const char *name = playdate->lua->getArgString(1);
+        if (name == NULL) {
+            Y_Error("brute.memory.stats: Subsystem name must be a string");
+            return 0;
+        }
+        for (int i = 0; i < NUMZSUBSYS; i++) {
+            if (strcmp(name, Z_SubsysName(i)) == 0) {
+                zsubsysstats_t stats;
+                Z_GetSubsysStats(i, &stats);
+                playdate->lua->pushInt(stats.live);
+                playdate->lua->pushInt(stats.peak);
+                playdate->lua->pushInt(stats.allocs);
+                playdate->lua->pushInt(stats.frees);
+                playdate->lua->pushInt(stats.frameallocs);
+                return 5;
+            }
+        }
+        Y_Error("brute.memory.stats: No subsystem named %s", name);
+        return 0;
+    }
+    zstats_t stats;
+    Z_GetStats(&stats);
+    playdate->lua->pushInt(stats.used);
+    playdate->lua->pushInt(stats.peak);
+    playdate->lua->pushInt(stats.largestfree);
+    playdate->lua->pushInt(stats.freeblocks);
+    playdate->lua->pushInt(stats.frameallocs);
+    return 5;
+}
+
+static int memory_dump(lua_State *L) {
+    Z_Dump();
+    return 0;
+}
+#endif
+
+static int sim_update(lua_State *L) {
+    // The Lua update starts here, so start a new frame.
+    PROF_FRAME();
+    PROF_BEGIN(PROF_LUA);
+    playdate->lua->pushInt(B_ClockUpdate());
+    return 1;
+}
+
+static int sim_reset(lua_State *L) {
+    B_ClockReset();
+    return 0;
+}
+
+static int sim_tic(lua_State *L) {
+    map_t *map = playdate->lua->getArgObject(1, MAP_CLASS, NULL);
+    M_SaveActorStates(map);
+    B_ClockTic();
     return 0;
 }
 
@@ -37,13 +157,29 @@ int eventHandler(PlaydateAPI *pd, PDSystemEvent event, uint32_t arg) {
     switch (event) {
         case kEventInitLua: {
             playdate = pd;
+            // Maps may be loaded before brute.init, so set up memory now.
+            Z_Init();
 
             playdate->lua->addFunction(init, "brute.init", NULL);
             playdate->lua->addFunction(quit, "brute.quit", NULL);
             playdate->lua->addFunction(render_draw, "brute.render.draw", NULL);
+            playdate->lua->addFunction(render_stats, "brute.render.stats", NULL);
+            playdate->lua->addFunction(render_strips, "brute.render.strips", NULL);
+            playdate->lua->addFunction(render_threads, "brute.render.threads", NULL);
+            playdate->lua->addFunction(sim_update, "brute.sim.update", NULL);
+#ifdef PROFILE
+            playdate->lua->addFunction(profile, "brute.profile", NULL);
+#endif
+#ifdef ZONE_TRACKING
+            playdate->lua->addFunction(memory_stats, "brute.memory.stats", NULL);
+            playdate->lua->addFunction(memory_dump, "brute.memory.dump", NULL);
+#endif
+            playdate->lua->addFunction(sim_reset, "brute.sim.reset", NULL);
+            playdate->lua->addFunction(sim_tic, "brute.sim.tic", NULL);
 
             register_actor_class();
             register_map_class();
+            register_texture_functions();
 
             break;
         }
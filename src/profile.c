@@ -0,0 +1,177 @@
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include "system.h"
+#include "video.h"
+#include "render/draw.h"
+
+#include <string.h>
+
+// Maximum nesting of stages.
+#define MAXPROFDEPTH 8
+
+// Number of characters in a line of the overlay.
+#define OVERLAYCHARS 10
+
+// Width of the overlay in bytes.
+#define OVERLAYBYTES 6
+
+// Height of a line of the overlay, including spacing.
+#define OVERLAYLINE 6
+
+// Times of each stage in the last frames, and of the whole frame last.
+static uint32_t ring[PROFFRAMES][NUMPROFSTAGES + 1];
+// Sums of the times in the ring buffer.
+static uint32_t sums[NUMPROFSTAGES + 1];
+// Next frame in the ring buffer to replace.
+static uint8_t ringpos;
+// Number of frames in the ring buffer.
+static uint8_t numframes;
+
+// Times of each stage in the current frame.
+static uint32_t current[NUMPROFSTAGES];
+// Stack of stages being timed.
+static profstage_t stack[MAXPROFDEPTH];
+// Number of stages being timed.
+static uint8_t depth;
+// Time when the innermost stage was last charged.
+static uint32_t lasttime;
+
+static bool showoverlay;
+
+// Labels of each stage in the overlay.
+static const char labels[NUMPROFSTAGES + 1][5] = {
+    "SECT",
+    "FLAT",
+    "ACTR",
+    "COLL",
+    "GRAV",
+    "LUA ",
+    "TOTL",
+};
+
+// A 3x5 font of the characters the overlay uses. Each octal digit is a row,
+// with the leftmost pixel in the high bit.
+static const char fontchars[] = "0123456789ACEFGLORSTUV";
+static const uint16_t fontglyphs[] = {
+    075557, 026227, 071747, 071717, 055711, 074717, 074757, 071111, 075757, 075717,
+    025755, 034443, 074647, 074644, 034553, 044447, 025552, 065655, 034216, 072222,
+    055557, 055552,
+};
+
+// Get the time since the start of the frame, in microseconds.
+static uint32_t Now(void) {
+    return playdate->system->getElapsedTime() * 1000000.0f;
+}
+
+// Charge the time since last charged to the innermost stage.
+static uint32_t Charge(void) {
+    uint32_t now = Now();
+    if (depth != 0) {
+        current[stack[depth - 1]] += now - lasttime;
+    }
+    lasttime = now;
+    return now;
+}
+
+void B_ProfileBegin(profstage_t stage) {
+    Charge();
+    if (depth < MAXPROFDEPTH) {
+        stack[depth++] = stage;
+    }
+}
+
+void B_ProfileEnd(profstage_t stage) {
+    if (depth == 0 || stack[depth - 1] != stage) {
+        return;
+    }
+    Charge();
+    --depth;
+}
+
+void B_ProfileFrame(void) {
+    uint32_t total = Charge();
+    // Replace the oldest frame in the ring buffer.
+    uint32_t *times = ring[ringpos];
+    for (int i = 0; i < NUMPROFSTAGES; i++) {
+        sums[i] += current[i] - times[i];
+        times[i] = current[i];
+    }
+    sums[NUMPROFSTAGES] += total - times[NUMPROFSTAGES];
+    times[NUMPROFSTAGES] = total;
+    ringpos = (ringpos + 1) % PROFFRAMES;
+    if (numframes < PROFFRAMES) {
+        ++numframes;
+    }
+    // Start timing the next frame. Stages left open, such as the Lua update
+    // of a frame that drew nothing, were charged above and end here.
+    depth = 0;
+    memset(current, 0, sizeof(current));
+    playdate->system->resetElapsedTime();
+    lasttime = 0;
+}
+
+void B_ProfileAverages(uint32_t averages[NUMPROFSTAGES + 1]) {
+    for (int i = 0; i <= NUMPROFSTAGES; i++) {
+        averages[i] = numframes != 0 ? sums[i] / numframes : 0;
+    }
+}
+
+// Draw a 3x5 character into a row of bits.
+static void DrawChar(uint8_t *bits, uint8_t x, uint8_t row, char c) {
+    const char *found = strchr(fontchars, c);
+    if (c == '\0' || found == NULL) {
+        return;
+    }
+    uint8_t glyphrow = (fontglyphs[found - fontchars] >> (3 * (4 - row))) & 7;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (glyphrow & (4 >> i)) {
+            bits[(x + i) >> 3] |= 0x80 >> ((x + i) & 7);
+        }
+    }
+}
+
+void B_ProfileOverlay(void) {
+    if (!showoverlay) {
+        return;
+    }
+    uint32_t averages[NUMPROFSTAGES + 1];
+    B_ProfileAverages(averages);
+    // Mask and bits of a row to blit.
+    uint8_t row[OVERLAYBYTES * 2];
+    drawblit_t blit = { row, OVERLAYBYTES, SCREENWIDTH - OVERLAYBYTES * 8, 0 };
+    for (int i = 0; i <= NUMPROFSTAGES; i++) {
+        // Format the line as a label followed by microseconds.
+        char text[OVERLAYCHARS + 1];
+        uint32_t us = averages[i] > 99999 ? 99999 : averages[i];
+        memcpy(text, labels[i], 4);
+        text[4] = ' ';
+        for (int j = OVERLAYCHARS - 1; j >= 5; j--) {
+            text[j] = us != 0 || j == OVERLAYCHARS - 1 ? '0' + us % 10 : ' ';
+            us /= 10;
+        }
+        text[OVERLAYCHARS] = '\0';
+        // Blit black text on white, with a margin around it.
+        for (uint8_t y = 0; y < OVERLAYLINE; y++) {
+            uint8_t bits[OVERLAYBYTES] = { 0 };
+            if (y != 0) {
+                for (int j = 0; j < OVERLAYCHARS; j++) {
+                    DrawChar(bits, 2 + 4 * j, y - 1, text[j]);
+                }
+            }
+            for (int j = 0; j < OVERLAYBYTES; j++) {
+                row[j * 2] = 0x00;
+                row[j * 2 + 1] = ~bits[j];
+            }
+            R_Blit(&blit);
+            ++blit.y;
+        }
+    }
+}
+
+void B_ProfileShowOverlay(bool show) {
+    showoverlay = show;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef BRUTE_B_PROFILE_H
+#define BRUTE_B_PROFILE_H
+
+/**
+ * Per-stage frame profiler. Scoped timers measure the time spent in each stage
+ * of a frame, excluding time spent in stages nested inside it, and keep the
+ * last PROFFRAMES frames in a ring buffer to average over. Only built when
+ * PROFILE is defined; otherwise the timers compile to nothing.
+ */
+
+#include "types.h"
+
+#include <stdbool.h>
+
+// Number of frames averaged over.
+#define PROFFRAMES 32
+
+// Stages of a frame.
+typedef enum {
+    PROF_SECTORS, // Walking sectors and drawing walls, in R_DrawSector.
+    PROF_FLATS,   // Drawing floors and ceilings, in R_DrawWallFlats.
+    PROF_ACTORS,  // Drawing sprites, in R_DrawActors.
+    PROF_MOVE,    // Collision, in M_MoveAndSlide.
+    PROF_GRAVITY, // Gravity, in actor_apply_gravity.
+    PROF_LUA,     // The rest of the Lua update, from brute.sim.update on.
+    NUMPROFSTAGES,
+} profstage_t;
+
+#ifdef PROFILE
+
+// Start timing a stage.
+void B_ProfileBegin(profstage_t stage);
+
+// Stop timing a stage. Does nothing unless it is the innermost stage.
+void B_ProfileEnd(profstage_t stage);
+
+// Finish the current frame, ending any stages still open, and start the next.
+void B_ProfileFrame(void);
+
+// Get the average time of each stage over the last frames, in microseconds,
+// followed by the average time of the whole frame.
+void B_ProfileAverages(uint32_t averages[NUMPROFSTAGES + 1]);
+
+// Draw the averages in a corner of the framebuffer if enabled.
+void B_ProfileOverlay(void);
+
+// Enable or disable the overlay.
+void B_ProfileShowOverlay(bool show);
+
+#define PROF_BEGIN(stage) B_ProfileBegin(stage)
+#define PROF_END(stage)   B_ProfileEnd(stage)
+#define PROF_FRAME()      B_ProfileFrame()
+#define PROF_OVERLAY()    B_ProfileOverlay()
+
+#else
+
+#define PROF_BEGIN(stage) ((void) 0)
+#define PROF_END(stage)   ((void) 0)
+#define PROF_FRAME()      ((void) 0)
+#define PROF_OVERLAY()    ((void) 0)
+
+#endif
+
+#endif
@@ -2,20 +2,13 @@
 #define BRUTE_R_ACTOR_H
 
 /**
- * Routines for drawing actors.
+ * Routines for drawing actors. Actors are queued and sorted on the main thread
+ * and then drawn by each strip, clipped to its columns.
  */
 
 #include "actor/actor.h"
 #include "render/defs.h"
-
-// Contains a pointer to a drawn wall and its X and Y bounds.
-typedef struct {
-    const wall_t *wall;   // Wall that this viswall represents.
-    uint16_t minx;        // Left X coordinate of portal, inclusive.
-    uint16_t maxx;        // Right X coordinate of portal, exclusive.
-    const uint8_t *miny;  // Minimum Y clipping bounds, inclusive.
-    const uint8_t *maxy;  // Maximum Y clipping bounds, exclusive.
-} viswall_t;
+#include "render/local.h"
 
 // Load the sprites.
 void load_sprites(void);
@@ -23,17 +16,22 @@ void load_sprites(void);
 // Unload the sprites.
 void free_sprites(void);
 
-// Empty the viswall stack.
-void R_ClearViswalls(void);
+// Empty the viswall stack of a strip.
+void R_ClearViswalls(renderctx_t *ctx);
 
-// Get a pointer to a viswall to write to, or NULL if out of space.
-viswall_t *R_NewViswall(void);
+// Get a pointer to a viswall of a strip to write to, or NULL if out of space.
+viswall_t *R_NewViswall(renderctx_t *ctx);
 
+// Empty the actor queue.
 void R_ClearActors(void);
 
+// Queue an actor to be drawn.
 void R_AddActor(const actor_t *actor);
 
-// Draw actors.
-void R_DrawActors(void);
+// Sort queued actors from back to front, removing duplicates.
+void R_SortActors(void);
+
+// Draw queued actors in a strip. Call R_SortActors first.
+void R_DrawActors(renderctx_t *ctx);
 
 #endif
@@ -1,5 +1,8 @@
+#include "log.h"
 #include "system.h"
+#include "tic.h"
 #include "video.h"
+#include "zone.h"
 #include "map/map.h"
 #include "render/actor.h"
 #include "render/draw.h"
@@ -15,12 +18,6 @@
 // Special value for fully blocked column.
 #define BLOCKED 254
 
-// This may be lowballing it.
-#define MAXVISWALLS 128
-
-static uint8_t numviswalls;
-static viswall_t viswalls[MAXVISWALLS];
-
 // List of sprite folder names by sprite type.
 static const char *const spritenames[NUMSPRITES] = {
     [SPR_TEST] = "test",
@@ -28,11 +25,19 @@ static const char *const spritenames[NUMSPRITES] = {
 
 typedef struct {
     const actor_t *actor;
+    vector_t pos; // Interpolated position.
+    float zpos;   // Interpolated vertical position.
     int32_t px, py;
 } visactor_t;
 
+// Room for actors to start with.
+#define MINVISACTORS 16
+
 static visactor_t *actor_array = NULL;
 static size_t num_actors = 0;
+// Number of actors actor_array has room for. It only grows, so that adding
+// actors does not allocate every frame.
+static size_t max_actors = 0;
 
 #define PACKED __attribute__((__packed__))
 
@@ -42,15 +47,18 @@ typedef struct PACKED {
     int16_t offy;         // Y offset.
     uint16_t width;       // Width.
     uint16_t height;      // Height.
+    uint8_t shadegap;     // Shade gap.
     uint32_t postoffs[0]; // Post offsets.
 } file_sprite_t;
 
-// A sprite.
+// A sprite. Each post is its length in texels, its offset from the end of the
+// previous post, and its nibble-packed texels. A zero length ends the column.
 typedef struct {
     int16_t offx;
     int16_t offy;
     uint16_t width;
     uint16_t height;
+    uint8_t shadegap;
     uint8_t *posts[0];
 } sprite_t;
 
@@ -81,40 +89,60 @@ static sprite_t *LoadSpriteFromFile(const char *name) {
     char *path;
     playdate->system->formatString(&path, "assets/sprites/%s", name);
     size_t size;
-    file_sprite_t *fsprite = read_file(path, &size);
-    playdate->system->realloc(path, 0);
-    if (fsprite->width == 0) {
+    SDFile *file = open_file(path, &size);
+    if (size < sizeof(file_sprite_t)) {
+        Y_Error("Sprite missing header");
+    }
+    file_sprite_t fsprite;
+    read_file_part(file, &fsprite, sizeof(file_sprite_t), path);
+    if (fsprite.width == 0) {
         // Maybe we could allow this?
-        playdate->system->error("Empty sprite");
+        Y_Error("Empty sprite");
+    }
+    if (fsprite.shadegap >= NUMSHADES) {
+        Y_Error("Sprite shade gap out of range");
+    }
+    size_t offssize = sizeof(uint32_t) * fsprite.width;
+    if (size < sizeof(file_sprite_t) + offssize) {
+        Y_Error("Sprite missing post offsets");
     }
-    uint8_t *fposts = (uint8_t *) fsprite + sizeof(file_sprite_t) + sizeof(uint32_t) * fsprite->width;
     // Calculate total size of posts.
-    size_t postsizetotal = size - (sizeof(file_sprite_t) + sizeof(uint32_t) * fsprite->width);
+    size_t postsizetotal = size - (sizeof(file_sprite_t) + offssize);
     // Allocate sprite.
-    sprite_t *sprite = playdate->system->realloc(NULL, sizeof(sprite_t) + sizeof(uint8_t *) * fsprite->width + postsizetotal);
-    sprite->offx = fsprite->offx;
-    sprite->offy = fsprite->offy;
-    sprite->width = fsprite->width;
-    sprite->height = fsprite->height;
-    uint8_t *posts = (uint8_t *) sprite + sizeof(sprite_t) + sizeof(uint8_t *) * fsprite->width;
-    // Copy posts.
-    memcpy(posts, fposts, postsizetotal);
-    // Set up pointers.
-    for (size_t i = 0; i < fsprite->width; i++) {
-        sprite->posts[i] = &posts[fsprite->postoffs[i]];
+    sprite_t *sprite = Z_Malloc(sizeof(sprite_t) + sizeof(uint8_t *) * fsprite.width + postsizetotal, PU_STATIC, NULL, ZS_SPRITE);
+    sprite->offx = fsprite.offx;
+    sprite->offy = fsprite.offy;
+    sprite->width = fsprite.width;
+    sprite->height = fsprite.height;
+    sprite->shadegap = fsprite.shadegap;
+    uint8_t *posts = (uint8_t *) sprite + sizeof(sprite_t) + sizeof(uint8_t *) * fsprite.width;
+    // Read the post offsets into the start of the pointer array, and the posts
+    // straight to their final place.
+    uint8_t *postoffs = (uint8_t *) sprite->posts;
+    read_file_part(file, postoffs, offssize, path);
+    read_file_part(file, posts, postsizetotal, path);
+    playdate->file->close(file);
+    playdate->system->realloc(path, 0);
+    // Set up pointers. Go backwards, as pointers may be wider than offsets, so
+    // each pointer only overwrites offsets that have already been converted.
+    for (size_t i = fsprite.width; i-- > 0;) {
+        uint32_t offset;
+        memcpy(&offset, &postoffs[sizeof(uint32_t) * i], sizeof(uint32_t));
+        if (offset >= postsizetotal) {
+            Y_Error("Sprite post offset out of range");
+        }
+        sprite->posts[i] = &posts[offset];
     }
-    // Free file data.
-    playdate->system->realloc(fsprite, 0);
     return sprite;
 }
 
 static void LoadAngle(sprite_t *sprite, spriteframe_t *frame, char a, bool flipped) {
     int32_t angle = a - '1';
     if (angle < 0 || angle >= 8) {
-        playdate->system->error("Angle index out of bounds");
+        Y_Error("Angle index out of bounds");
     }
     if (frame->sprites[angle] != NULL) {
-        playdate->system->error("Duplicate angle");
+        Y_Error("Duplicate angle");
     }
     frame->sprites[angle] = sprite;
     if (flipped) {
@@ -163,7 +191,7 @@ void load_sprites(void) {
         // Allocate frames.
         // TODO determine number of frames!
         spritedef->numframes = 1;
-        spritedef->frames = playdate->system->realloc(NULL, sizeof(spriteframe_t) * spritedef->numframes);
+        spritedef->frames = Z_Malloc(sizeof(spriteframe_t) * spritedef->numframes, PU_STATIC, NULL, ZS_SPRITE);
         memset(spritedef->frames, 0, sizeof(spriteframe_t) * spritedef->numframes);
         // For each frame...
         playdate->file->listfiles("assets/sprites", LoadFrameCallback, NULL, 0);
@@ -177,21 +205,22 @@ void free_sprites(void) {
             spriteframe_t *frame = &spritedef->frames[j];
             for (uint8_t k = 0; k < 8; k++) {
                 if (frame->unique & (1 << k)) {
-                    playdate->system->realloc(frame->sprites[k], 0);
+                    Z_Free(frame->sprites[k]);
                 }
             }
-            playdate->system->realloc(frame, 0);
         }
+        Z_Free(spritedef->frames);
+        spritedef->frames = NULL;
     }
 }
 
-void R_ClearViswalls(void) {
-    numviswalls = 0;
+void R_ClearViswalls(renderctx_t *ctx) {
+    ctx->numviswalls = 0;
 }
 
-viswall_t *R_NewViswall(void) {
-    if (numviswalls < MAXVISWALLS) {
-        return &viswalls[numviswalls++];
+viswall_t *R_NewViswall(renderctx_t *ctx) {
+    if (ctx->numviswalls < MAXVISWALLS) {
+        return &ctx->viswalls[ctx->numviswalls++];
     }
     return NULL;
 }
@@ -206,12 +235,7 @@ static uint16_t ClipX(int32_t x) {
     }
 }
 
-// Minimum Y coordinate for sprite, inclusive.
-static uint8_t miny[SCREENWIDTH];
-// Maximum Y coordinate for sprite, exclusive.
-static uint8_t maxy[SCREENWIDTH];
-
-static uint8_t ClipY(int32_t y, uint16_t x) {
+static uint8_t ClipY(const uint8_t *miny, const uint8_t *maxy, int32_t y, uint16_t x) {
     if (miny[x] == UNBLOCKED) {
         if (y < 0) {
             return 0;
@@ -231,8 +255,9 @@ static uint8_t ClipY(int32_t y, uint16_t x) {
     }
 }
 
-static void DrawActor(const visactor_t *visactor) {
-    const actor_t *actor = visactor->actor;
+static void DrawActor(renderctx_t *ctx, const visactor_t *visactor) {
+    uint8_t *miny = ctx->spriteminy;
+    uint8_t *maxy = ctx->spritemaxy;
     int32_t px = visactor->px;
     int32_t py = visactor->py;
     // Get sprite.
@@ -248,22 +273,33 @@ static void DrawActor(const visactor_t *visactor) {
         // Don't draw empty sprite.
         return;
     }
+    // Only draw the columns in the strip.
     uint16_t minx = ClipX(x1 >> FRACBITS);
     uint16_t maxx = ClipX(x2 >> FRACBITS);
+    if (minx < ctx->stripmin) {
+        minx = ctx->stripmin;
+    }
+    if (maxx > ctx->stripmax) {
+        maxx = ctx->stripmax;
+    }
+    if (minx >= maxx) {
+        return;
+    }
+    ++ctx->stats.actors;
 
     // Mark all columns as unblocked.
     memset(&miny[minx], UNBLOCKED, maxx - minx);
 
     // Iterate over sectors from back to front to clip the sprite.
-    for (int i = numviswalls - 1; i >= 0; i--) {
+    for (int i = ctx->numviswalls - 1; i >= 0; i--) {
         // Check viswall.
-        const viswall_t *viswall = &viswalls[i];
+        const viswall_t *viswall = &ctx->viswalls[i];
         // Check if in bounds of this wall's X coordinates.
         if (minx > viswall->maxx || maxx < viswall->minx) {
             continue;
         }
         // Check if behind this wall.
-        if (M_PointInFrontOfWall(viswall->wall, &actor->pos)) {
+        if (M_PointInFrontOfWall(viswall->wall, &visactor->pos)) {
             continue;
         }
         // Bounds to draw.
@@ -288,11 +324,13 @@ static void DrawActor(const visactor_t *visactor) {
         }
     }
     // Set scale of texture.
-    dc_scale = (py << FRACBITS) / SCRNDISTI;
+    drawcolumn_t *dc = &ctx->dc;
+    dc->scale = (py << FRACBITS) / SCRNDISTI;
     // Don't loop texture.
-    dc_height = 0x8000;
+    dc->height = 0x8000;
+    dc->shades = R_ShadeTable(visactor->actor->sector->light, py, sprite->shadegap);
     // Draw each column.
-    fixed_t yoff = fixed_mul(rendereyeheight - float_to_fixed(actor->zpos) - (sprite->offy << FRACBITS), scale);
+    fixed_t yoff = fixed_mul(rendereyeheight - float_to_fixed(visactor->zpos) - (sprite->offy << FRACBITS), scale);
     for (uint16_t x = minx; x < maxx; x++) {
         if (miny[x] == BLOCKED) {
             // Clipped bound. skip.
@@ -308,22 +346,19 @@ static void DrawActor(const visactor_t *visactor) {
             fixed_t yh = yoff + (scale * spot);
             spot += length;
             fixed_t yl = yoff + (scale * spot);
-            dc_source = posts;
-            dc_x = x;
-            dc_yh = ClipY((yh >> FRACBITS) + (SCREENHEIGHT >> 1), x);
-            dc_yl = ClipY((yl >> FRACBITS) + (SCREENHEIGHT >> 1), x);
-            dc_offset = -fixed_mul(dc_scale, yh);
-            R_DrawColumn();
-            posts += length;
+            dc->source = posts;
+            dc->x = x;
+            dc->yh = ClipY(miny, maxy, (yh >> FRACBITS) + (SCREENHEIGHT >> 1), x);
+            dc->yl = ClipY(miny, maxy, (yl >> FRACBITS) + (SCREENHEIGHT >> 1), x);
+            dc->offset = -fixed_mul(dc->scale, yh);
+            R_DrawColumn(dc);
+            ++ctx->stats.columns;
+            posts += PATCHCOLUMNBYTES(length);
         }
     }
 }
 
 void R_ClearActors(void) {
-    if (actor_array != NULL) {
-        playdate->system->realloc(actor_array, 0);
-        actor_array = NULL;
-    }
     num_actors = 0;
 }
 
@@ -332,9 +367,13 @@ void R_AddActor(const actor_t *actor) {
     if (actor->flags & ACTOR_NORENDER) {
         return;
     }
+    // Interpolate position between the last two tics.
+    vector_t lerppos;
+    float lerpzpos, lerpangle;
+    actor_lerp(actor, ticfrac, &lerppos, &lerpzpos, &lerpangle);
     // Translate position locally.
     vector_t pos;
-    U_VecCopy(&pos, &actor->pos);
+    U_VecCopy(&pos, &lerppos);
     U_VecSub(&pos, &renderpos);
     R_RotatePoint(&pos);
     int32_t px = floorf(pos.x);
@@ -344,24 +383,55 @@ void R_AddActor(const actor_t *actor) {
         return;
     }
 
-    actor_array = playdate->system->realloc(actor_array, sizeof(visactor_t) * (num_actors + 1));
+    if (num_actors == max_actors) {
+        // Double the room for actors.
+        size_t newmax = max_actors != 0 ? max_actors * 2 : MINVISACTORS;
+        visactor_t *newarray = Z_Malloc(sizeof(visactor_t) * newmax, PU_STATIC, NULL, ZS_RENDER);
+        if (actor_array != NULL) {
+            memcpy(newarray, actor_array, sizeof(visactor_t) * num_actors);
+            Z_Free(actor_array);
+        }
+        actor_array = newarray;
+        max_actors = newmax;
+    }
 
     visactor_t *entry = &actor_array[num_actors++];
     entry->actor = actor;
+    U_VecCopy(&entry->pos, &lerppos);
+    entry->zpos = lerpzpos;
     entry->px = px;
     entry->py = py;
 }
 
+// Sort actors from back to front. Ties are broken by address, so that the
+// order does not depend on the order actors were queued in.
 static int SortActors(const void *p, const void *q) {
     const visactor_t *ap = p;
     const visactor_t *aq = q;
-    return aq->py - ap->py;
+    if (ap->py != aq->py) {
+        return aq->py - ap->py;
+    }
+    return (ap->actor > aq->actor) - (ap->actor < aq->actor);
 }
 
-void R_DrawActors(void) {
+void R_SortActors(void) {
+    if (num_actors == 0) {
+        return;
+    }
     qsort(actor_array, num_actors, sizeof(visactor_t), SortActors);
+    // An actor is queued once for each time its sector is visited, and the
+    // copies end up next to each other. Only keep one.
+    size_t count = 1;
+    for (size_t i = 1; i < num_actors; i++) {
+        if (actor_array[i].actor != actor_array[count - 1].actor) {
+            actor_array[count++] = actor_array[i];
+        }
+    }
+    num_actors = count;
+}
+
+void R_DrawActors(renderctx_t *ctx) {
     for (size_t i = 0; i < num_actors; i++) {
-        DrawActor(&actor_array[i]);
+        DrawActor(ctx, &actor_array[i]);
     }
-    R_ClearActors();
 }
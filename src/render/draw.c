@@ -2,6 +2,8 @@
 #include "video.h"
 #include "render/draw.h"
 
+#include <string.h>
+
 // Number of bytes in a framebuffer row.
 #define ROWSTRIDE 52
 
@@ -14,33 +16,11 @@
 // Framebuffer.
 static uint8_t *__attribute__((aligned(4))) renderbuf;
 
-const uint8_t *dc_source;
-uint16_t       dc_height;
-fixed_t        dc_scale;
-fixed_t        dc_offset;
-uint16_t       dc_x;
-uint8_t        dc_yh;
-uint8_t        dc_yl;
-
-const uint8_t *ds_source;
-fixed_t        ds_xstep;
-fixed_t        ds_ystep;
-fixed_t        ds_xfrac;
-fixed_t        ds_yfrac;
-uint16_t       ds_x1;
-uint16_t       ds_x2;
-uint8_t        ds_y;
-
-const uint8_t *blit_source;
-uint8_t        blit_length;
-uint16_t       blit_x;
-uint8_t        blit_y;
-
 #define DitherPattern(a, b, c, d) { a * 0x11, b * 0x11, c * 0x11, d * 0x11 }
 
 extern uint8_t detaillevel;
 
-static const uint8_t drawshades[17][4] = {
+static const uint8_t drawshades[NUMSHADES][4] = {
     DitherPattern(0x0, 0x0, 0x0, 0x0),
     DitherPattern(0x8, 0x0, 0x0, 0x0),
     DitherPattern(0x8, 0x0, 0x2, 0x0),
@@ -58,10 +38,50 @@ static const uint8_t drawshades[17][4] = {
     DitherPattern(0xf, 0x7, 0xf, 0xd),
     DitherPattern(0xf, 0x7, 0xf, 0xf),
     DitherPattern(0xf, 0xf, 0xf, 0xf),
-    // TODO buffer overflow can occur if we have a texture that accesses higher
-    // palette indices. We should check for this.
 };
 
+// Shade tables, darkening drawshades in even steps, for each shade gap.
+static shadetable_t shadetables[NUMSHADETABLES][NUMSHADES];
+
+// Index of the shade tables by light level and distance band.
+static uint8_t lighttables[LIGHTLEVELS][DISTBANDS];
+
+void R_InitLighting(void) {
+    for (uint8_t i = 0; i < NUMSHADETABLES; i++) {
+        for (uint8_t gap = 0; gap < NUMSHADES; gap++) {
+            for (uint8_t texel = 0; texel < 16; texel++) {
+                uint8_t shade = texel < gap ? texel : texel + 1;
+                uint8_t dark = (shade * (NUMSHADETABLES - i) + (NUMSHADETABLES >> 1)) / NUMSHADETABLES;
+                memcpy(shadetables[i][gap][texel], drawshades[dark], sizeof(drawshades[dark]));
+            }
+        }
+    }
+    // Each light level below the brightest starts one table darker, and every
+    // two distance bands darken by one more.
+    for (uint8_t light = 0; light < LIGHTLEVELS; light++) {
+        for (uint8_t band = 0; band < DISTBANDS; band++) {
+            uint8_t i = (LIGHTLEVELS - 1 - light) + (band >> 1);
+            if (i >= NUMSHADETABLES) {
+                i = NUMSHADETABLES - 1;
+            }
+            lighttables[light][band] = i;
+        }
+    }
+}
+
+const shadetable_t *R_ShadeTable(uint8_t light, int32_t dist, uint8_t shadegap) {
+    uint32_t band = (uint32_t) dist >> DISTBANDSHIFT;
+    if (band >= DISTBANDS) {
+        band = DISTBANDS - 1;
+    }
+    return &shadetables[lighttables[light / (256 / LIGHTLEVELS)][band]][shadegap];
+}
+
+// Read a texel from nibble-packed texture data.
+static inline uint8_t GetTexel(const uint8_t *source, uint32_t index) {
+    return (source[index >> 1] >> ((index & 1) << 2)) & 15;
+}
+
 // Plot a pixel.
 static inline void PlotPixel(uint8_t *framebuffer, uint8_t shade, uint8_t mask) {
     uint8_t value = *framebuffer;
@@ -89,22 +109,23 @@ void R_FlushFramebuffer(void) {
     playdate->graphics->markUpdatedRows(0, LCD_ROWS - 1);
 }
 
-static void R_DrawColumnHigh(void) {
-    uint8_t yh = dc_yh;
-    uint8_t yl = dc_yl;
+static void R_DrawColumnHigh(const drawcolumn_t *dc) {
+    uint8_t yh = dc->yh;
+    uint8_t yl = dc->yl;
     // Framebuffer and mask to draw to.
-    uint8_t *framebuffer = &renderbuf[(dc_x >> 3) + (ROWSTRIDE * yh)];
-    uint8_t xmask = 1 << (7 - (dc_x & 7));
-    const uint8_t *source = dc_source;
+    uint8_t *framebuffer = &renderbuf[(dc->x >> 3) + (ROWSTRIDE * yh)];
+    uint8_t xmask = 1 << (7 - (dc->x & 7));
+    const uint8_t *source = dc->source;
+    const uint8_t (*shades)[4] = *dc->shades;
     // For speed, use fixed-point accumulator instead of repeated multiply and divide.
-    fixed_t fracstep = dc_scale;
+    fixed_t fracstep = dc->scale;
     // Convert scale to mask.
-    fixed_t mask = STEPMASK(dc_height - 1);
-    fixed_t frac = (fracstep * (yh - (SCREENHEIGHT >> 1)) + dc_offset) & mask;
+    fixed_t mask = STEPMASK(dc->height - 1);
+    fixed_t frac = (fracstep * (yh - (SCREENHEIGHT >> 1)) + dc->offset) & mask;
     for (uint8_t y = yh; y < yl; y++) {
         // Plot pixel.
-        uint8_t pixel = source[frac >> FRACBITS];
-        PlotPixel(framebuffer, drawshades[pixel][y & 3], xmask);
+        uint8_t pixel = GetTexel(source, frac >> FRACBITS);
+        PlotPixel(framebuffer, shades[pixel][y & 3], xmask);
         // Advance fractional step.
         frac = (frac + fracstep) & mask;
         // Move to next row to copy to.
@@ -112,25 +133,26 @@ static void R_DrawColumnHigh(void) {
     }
 }
 
-static void R_DrawColumnLow(void) {
+static void R_DrawColumnLow(const drawcolumn_t *dc) {
     // Skip if odd column.
-    if (dc_x & 1) return;
+    if (dc->x & 1) return;
 
-    uint8_t yh = dc_yh;
-    uint8_t yl = dc_yl;
+    uint8_t yh = dc->yh;
+    uint8_t yl = dc->yl;
     // Framebuffer and mask to draw to.
-    uint8_t *framebuffer = &renderbuf[(dc_x >> 3) + (ROWSTRIDE * yh)];
-    uint8_t xmask = 3 << (6 - (dc_x & 6));
-    const uint8_t *source = dc_source;
+    uint8_t *framebuffer = &renderbuf[(dc->x >> 3) + (ROWSTRIDE * yh)];
+    uint8_t xmask = 3 << (6 - (dc->x & 6));
+    const uint8_t *source = dc->source;
+    const uint8_t (*shades)[4] = *dc->shades;
     // For speed, use fixed-point accumulator instead of repeated multiply and divide.
-    fixed_t fracstep = dc_scale;
+    fixed_t fracstep = dc->scale;
     // Convert scale to mask.
-    fixed_t mask = STEPMASK(dc_height - 1);
-    fixed_t frac = (fracstep * (yh - (SCREENHEIGHT >> 1)) + dc_offset) & mask;
+    fixed_t mask = STEPMASK(dc->height - 1);
+    fixed_t frac = (fracstep * (yh - (SCREENHEIGHT >> 1)) + dc->offset) & mask;
     for (uint8_t y = yh; y < yl; y++) {
         // Plot pixel.
-        uint8_t pixel = source[frac >> FRACBITS];
-        PlotPixelLow(framebuffer, drawshades[pixel][y & 3], xmask);
+        uint8_t pixel = GetTexel(source, frac >> FRACBITS);
+        PlotPixelLow(framebuffer, shades[pixel][y & 3], xmask);
         // Advance fractional step.
         frac = (frac + fracstep) & mask;
         // Move to next row to copy to.
@@ -138,23 +160,24 @@ static void R_DrawColumnLow(void) {
     }
 }
 
-void R_DrawColumn(void) {
-    detaillevel ? R_DrawColumnLow() : R_DrawColumnHigh();
+void R_DrawColumn(const drawcolumn_t *dc) {
+    detaillevel ? R_DrawColumnLow(dc) : R_DrawColumnHigh(dc);
 }
 
-static void R_DrawSpanHigh(void) {
-    uint16_t x1 = ds_x1;
-    uint16_t x2 = ds_x2;
-    uint8_t y = ds_y;
-    const uint8_t *source = ds_source;
+static void R_DrawSpanHigh(const drawspan_t *ds) {
+    uint16_t x1 = ds->x1;
+    uint16_t x2 = ds->x2;
+    uint8_t y = ds->y;
+    const uint8_t *source = ds->source;
+    const uint8_t (*shades)[4] = *ds->shades;
     // Framebuffer and mask to draw to.
     uint8_t *framebuffer = &renderbuf[(x1 >> 3) + (ROWSTRIDE * y)];
     uint8_t xmask = 1 << (7 - (x1 & 7));
     // Copy variables.
-    fixed_t fracstepx = ds_xstep;
-    fixed_t fracstepy = ds_ystep;
-    fixed_t fracx = ds_xfrac & FLATMASK;
-    fixed_t fracy = ds_yfrac & FLATMASK;
+    fixed_t fracstepx = ds->xstep;
+    fixed_t fracstepy = ds->ystep;
+    fixed_t fracx = ds->xfrac & FLATMASK;
+    fixed_t fracy = ds->yfrac & FLATMASK;
     y &= 3;
     for (uint16_t x = x1; x < x2; x++) {
         // Calculate index.
@@ -162,8 +185,8 @@ static void R_DrawSpanHigh(void) {
         uint8_t newy = fracy >> FRACBITS;
         uint16_t index = newx | (newy << 6);
         // Plot pixel.
-        uint8_t pixel = source[index];
-        PlotPixel(framebuffer, drawshades[pixel][y], xmask);
+        uint8_t pixel = GetTexel(source, index);
+        PlotPixel(framebuffer, shades[pixel][y], xmask);
         // Advance fractional steps.
         fracx = (fracx + fracstepx) & FLATMASK;
         fracy = (fracy + fracstepy) & FLATMASK;
@@ -176,19 +199,22 @@ static void R_DrawSpanHigh(void) {
     }
 }
 
-static void R_DrawSpanLow(void) {
-    uint16_t x1 = ds_x1 & ~1;
-    uint16_t x2 = ds_x2 & ~1;
-    uint8_t y = ds_y;
-    const uint8_t *source = ds_source;
+static void R_DrawSpanLow(const drawspan_t *ds) {
+    uint16_t x1 = ds->x1 & ~1;
+    uint16_t x2 = ds->x2 & ~1;
+    uint8_t y = ds->y;
+    const uint8_t *source = ds->source;
+    const uint8_t (*shades)[4] = *ds->shades;
     // Framebuffer and mask to draw to.
     uint8_t *framebuffer = &renderbuf[(x1 >> 3) + (ROWSTRIDE * y)];
     uint8_t xmask = 3 << (6 - (x1 & 6));
     // Copy variables.
-    fixed_t fracstepx = ds_xstep << 1;
-    fixed_t fracstepy = ds_ystep << 1;
-    fixed_t fracx = ds_xfrac & FLATMASK;
-    fixed_t fracy = ds_yfrac & FLATMASK;
+    fixed_t fracstepx = ds->xstep * 2;
+    fixed_t fracstepy = ds->ystep * 2;
+    // Start at the left pixel of the first pair, which is left of x1 if x1 is
+    // odd, so that a pair's texel does not depend on where its span starts.
+    fixed_t fracx = (ds->xfrac - ds->xstep * (ds->x1 & 1)) & FLATMASK;
+    fixed_t fracy = (ds->yfrac - ds->ystep * (ds->x1 & 1)) & FLATMASK;
     y &= 3;
     for (uint16_t x = x1; x < x2; x += 2) {
         // Calculate index.
@@ -196,8 +222,8 @@ static void R_DrawSpanLow(void) {
         uint8_t newy = fracy >> FRACBITS;
         uint16_t index = newx | (newy << 6);
         // Plot pixel.
-        uint8_t pixel = source[index];
-        PlotPixelLow(framebuffer, drawshades[pixel][y], xmask);
+        uint8_t pixel = GetTexel(source, index);
+        PlotPixelLow(framebuffer, shades[pixel][y], xmask);
         // Advance fractional steps.
         fracx = (fracx + fracstepx) & FLATMASK;
         fracy = (fracy + fracstepy) & FLATMASK;
@@ -210,16 +236,16 @@ static void R_DrawSpanLow(void) {
     }
 }
 
-void R_DrawSpan(void) {
-    detaillevel ? R_DrawSpanLow() : R_DrawSpanHigh();
+void R_DrawSpan(const drawspan_t *ds) {
+    detaillevel ? R_DrawSpanLow(ds) : R_DrawSpanHigh(ds);
 }
 
-void R_Blit(void) {
+void R_Blit(const drawblit_t *blit) {
     // Copy parameters.
-    const uint8_t *source = blit_source;
-    uint8_t length = blit_length;
-    uint16_t x = blit_x;
-    uint8_t y = blit_y;
+    const uint8_t *source = blit->source;
+    uint8_t length = blit->length;
+    uint16_t x = blit->x;
+    uint8_t y = blit->y;
     // Framebuffer pointer.
     uint8_t *framebuffer = &renderbuf[(x >> 3) + (ROWSTRIDE * y)];
     // Create mask mask.
@@ -4,9 +4,12 @@
 /**
  * Low-level drawing routines.
  * Before calling, make sure that the bounds are correct and that all parameters
- * are set. These functions make no checks.
+ * are set. These functions make no checks. Parameters are passed in structs
+ * rather than globals, so that several threads can draw to different columns
+ * of the framebuffer at once.
  */
 
+#include "map/defs.h"
 #include "render/fixed.h"
 
 // Load the current framebuffer. Call this before calling other routines in a frame.
@@ -15,39 +18,71 @@ void R_LoadFramebuffer(void);
 // Flush the framebuffer. Call this after finished drawing a scene.
 void R_FlushFramebuffer(void);
 
+// Number of light levels. Sector light levels from 0 to 255 are divided evenly.
+#define LIGHTLEVELS 16
+
+// Number of distance bands.
+#define DISTBANDS 16
+
+// Log2 of the size of a distance band in world units.
+#define DISTBANDSHIFT 7
+
+// Number of shade tables, from brightest to darkest.
+#define NUMSHADETABLES 16
+
+// A shade table maps each texel of a texture to the dither pattern of each row
+// modulo 4. There is a table for each shade gap, leaving out that shade.
+typedef uint8_t shadetable_t[16][4];
+
+// Build the lighting tables. Call this before drawing.
+void R_InitLighting(void);
+
+// Get the shade table for a light level at a distance in world units, for a
+// texture with the given shade gap.
+const shadetable_t *R_ShadeTable(uint8_t light, int32_t dist, uint8_t shadegap);
+
 // Parameters for R_DrawColumn.
-extern const uint8_t *dc_source; // Column to draw.
-extern uint16_t       dc_height; // Height of column to draw.
-extern fixed_t        dc_scale;  // Amount to stretch.
-extern fixed_t        dc_offset; // Offset of column texture.
-extern uint16_t       dc_x;      // X coordinate to draw in.
-extern uint8_t        dc_yh;     // Top Y coordinate of column, inclusive.
-extern uint8_t        dc_yl;     // Bottom Y coordinate of column, exclusive.
+typedef struct {
+    const uint8_t *source; // Column to draw, two texels per byte.
+    const shadetable_t *shades; // Shade table, from R_ShadeTable.
+    uint16_t       height; // Height of column to draw.
+    fixed_t        scale;  // Amount to stretch.
+    fixed_t        offset; // Offset of column texture.
+    uint16_t       x;      // X coordinate to draw in.
+    uint8_t        yh;     // Top Y coordinate of column, inclusive.
+    uint8_t        yl;     // Bottom Y coordinate of column, exclusive.
+} drawcolumn_t;
 
 // Draw a column top-down. Bounds are not checked.
-void R_DrawColumn(void);
+void R_DrawColumn(const drawcolumn_t *dc);
 
 // Parameters for R_DrawSpan.
-extern const uint8_t *ds_source; // Span to draw.
-extern fixed_t        ds_xstep;  // Amount to step X coordinate.
-extern fixed_t        ds_ystep;  // Amount to step Y coordinate.
-extern fixed_t        ds_xfrac;  // Starting X coordinate.
-extern fixed_t        ds_yfrac;  // Starting Y coordinate.
-extern uint16_t       ds_x1;     // Left X coordinate of span, inclusive.
-extern uint16_t       ds_x2;     // Right X coordinate of span, exclusive.
-extern uint8_t        ds_y;      // Y coordinate to draw in.
-
-// Draw a span left to right. Bounds are not checked.
-void R_DrawSpan(void);
+typedef struct {
+    const uint8_t *source; // Span to draw, two texels per byte.
+    const shadetable_t *shades; // Shade table, from R_ShadeTable.
+    fixed_t        xstep;  // Amount to step X coordinate.
+    fixed_t        ystep;  // Amount to step Y coordinate.
+    fixed_t        xfrac;  // X coordinate at x1.
+    fixed_t        yfrac;  // Y coordinate at x1.
+    uint16_t       x1;     // Left X coordinate of span, inclusive.
+    uint16_t       x2;     // Right X coordinate of span, exclusive.
+    uint8_t        y;      // Y coordinate to draw in.
+} drawspan_t;
+
+// Draw a span left to right. Bounds are not checked. At low detail, pixels are
+// drawn in pairs, and each pair is textured as its left pixel.
+void R_DrawSpan(const drawspan_t *ds);
 
 // Parameters for R_Blit.
-extern const uint8_t *blit_source; // Bits to blit. Must be in interleaved format.
-extern uint8_t        blit_length; // Number of bytes to blit.
-extern uint16_t       blit_x;      // Starting X position.
-extern uint8_t        blit_y;      // Y position.
+typedef struct {
+    const uint8_t *source; // Bits to blit. Must be in interleaved format.
+    uint8_t        length; // Number of bytes to blit.
+    uint16_t       x;      // Starting X position.
+    uint8_t        y;      // Y position.
+} drawblit_t;
 
 // Blit a row of bits to the framebuffer. Bounds are not checked.
 // Bits should not be blitted partially off-screen.
-void R_Blit(void);
+void R_Blit(const drawblit_t *blit);
 
 #endif
@@ -2,7 +2,8 @@
 #define BRUTE_R_FIXED_H
 
 /**
- * Fixed-point math for rendering routines.
+ * Fixed-point math for rendering routines. Everything is inline, as these are
+ * used in the hot paths of the renderer.
  */
 
 #include <limits.h>
@@ -18,12 +19,22 @@ typedef int32_t fixed_t;
 #define INTBITS ((CHAR_BIT * sizeof(fixed_t)) - FRACBITS)
 
 // Multiply two fixed-point integers.
-fixed_t fixed_mul(fixed_t a, fixed_t b);
+static inline fixed_t fixed_mul(fixed_t a, fixed_t b) {
+    return ((int64_t) a * b) >> FRACBITS;
+}
 
 // Divide two fixed-point integers.
-fixed_t fixed_div(fixed_t a, fixed_t b);
-
-// Convert a float to a fixed-point number.
-fixed_t float_to_fixed(float f);
+static inline fixed_t fixed_div(fixed_t a, fixed_t b) {
+    return ((int64_t) a << FRACBITS) / b;
+}
+
+// Convert a float to a fixed-point number, rounding down. Scaling by a power of
+// two is exact, so only the conversion to integer needs care: it truncates,
+// which must be corrected for negative fractions.
+static inline fixed_t float_to_fixed(float f) {
+    float scaled = f * (1 << FRACBITS);
+    fixed_t result = (fixed_t) scaled;
+    return result - (scaled < (float) result);
+}
 
 #endif
@@ -4,6 +4,7 @@
 #include "render/local.h"
 
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 static fixed_t offx;       // X offset
@@ -11,43 +12,48 @@ static fixed_t offy;       // Y offset
 static fixed_t flatsine;   // Sine angle value
 static fixed_t flatcosine; // Cosine angle value
 
-static fixed_t heightcos;
-static fixed_t heightsin;
-
-void R_InitFlatGlobals(float angle) {
+void R_InitFlatGlobals(angle_t angle) {
     // Calculate the X and Y offsets.
     offx = float_to_fixed(renderpos.x) & ((0x40 << FRACBITS) - 1);
     offy = float_to_fixed(renderpos.y) & ((0x40 << FRACBITS) - 1);
     // Calculate the sine and cosine.
-    flatsine = float_to_fixed(SCRNDIST * sinf(-angle));
-    flatcosine = float_to_fixed(SCRNDIST * cosf(-angle));
+    flatsine = float_to_fixed(SCRNDIST * U_Sine(-angle));
+    flatcosine = float_to_fixed(SCRNDIST * U_Cosine(-angle));
 }
 
-static void DrawLine(uint8_t y, uint16_t x1, uint16_t x2) {
+static void DrawLine(renderctx_t *ctx, uint8_t y, uint16_t x1, uint16_t x2) {
     int32_t den = (int32_t) y - 120;
     // To be careful, don't draw if we'd divide by zero.
     if (den != 0) {
-        ds_x1 = x1;
-        ds_x2 = x2;
-        ds_y = y;
-        ds_xstep = -heightcos / (den * SCRNDISTI);
-        ds_ystep = -heightsin / (den * SCRNDISTI);
-        ds_xfrac = (ds_xstep * ds_x1 + ((heightcos - heightsin) / den) - offx);
-        ds_yfrac = (ds_ystep * ds_x1 + ((heightsin + heightcos) / den) + offy);
-        R_DrawSpan();
+        drawspan_t *ds = &ctx->ds;
+        fixed_t heightcos = ctx->heightcos;
+        fixed_t heightsin = ctx->heightsin;
+        ds->x1 = x1;
+        ds->x2 = x2;
+        ds->y = y;
+        ds->shades = R_ShadeTable(ctx->rendersector->light, ((int64_t) ctx->flatheight * SCRNDISTI / abs(den)) >> FRACBITS, ctx->flatshadegap);
+        ds->xstep = -heightcos / (den * SCRNDISTI);
+        ds->ystep = -heightsin / (den * SCRNDISTI);
+        ds->xfrac = (ds->xstep * ds->x1 + ((heightcos - heightsin) / den) - offx);
+        ds->yfrac = (ds->ystep * ds->x1 + ((heightsin + heightcos) / den) + offy);
+        R_DrawSpan(ds);
+        ++ctx->stats.spans;
     }
 }
 
-void R_DrawFlat(const flat_t *flat, const uint8_t *miny, const uint8_t *maxy, int32_t height) {
-    static uint16_t spanstart[SCREENHEIGHT];
+void R_DrawFlat(renderctx_t *ctx, const flat_t *flat, const uint8_t *miny, const uint8_t *maxy, int32_t height) {
+    uint16_t *spanstart = ctx->spanstart;
+    uint16_t sectorxmax = ctx->drawxmax;
 
     // Calculate the height values.
-    heightcos = fixed_mul(height, flatcosine);
-    heightsin = fixed_mul(height, flatsine);
+    ctx->heightcos = fixed_mul(height, flatcosine);
+    ctx->heightsin = fixed_mul(height, flatsine);
+    ctx->flatheight = abs(height);
     // Set span source.
-    ds_source = flat->data;
+    ctx->ds.source = flat->data;
+    ctx->flatshadegap = flat->shadegap;
 
-    uint16_t startx = sectorxmin;
+    uint16_t startx = ctx->drawxmin;
     uint8_t t1, b1;
     for (;;) {
         t1 = miny[startx];
@@ -67,12 +73,12 @@ void R_DrawFlat(const flat_t *flat, const uint8_t *miny, const uint8_t *maxy, in
         uint8_t t2 = miny[x];
         uint8_t b2 = maxy[x];
         while (t1 < t2 && t1 < b1) {
-            DrawLine(t1, spanstart[t1], x);
+            DrawLine(ctx, t1, spanstart[t1], x);
             t1++;
         }
         while (b1 > b2 && t1 < b1) {
             b1--;
-            DrawLine(b1, spanstart[b1], x);
+            DrawLine(ctx, b1, spanstart[b1], x);
         }
         while (t1 > t2 && t1 < b1) {
             t1--;
@@ -89,6 +95,6 @@ void R_DrawFlat(const flat_t *flat, const uint8_t *miny, const uint8_t *maxy, in
     }
     // Finish drawing spans that reach to the edge.
     for (uint8_t y = t1; y < b1; y++) {
-        DrawLine(y, spanstart[y], sectorxmax);
+        DrawLine(ctx, y, spanstart[y], sectorxmax);
     }
 }
\ No newline at end of file
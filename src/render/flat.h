@@ -6,15 +6,18 @@
  */
 
 #include "map/defs.h"
+#include "render/local.h"
+#include "util/angle.h"
 
 // Initialize globals used for flat rendering. Call once before drawing a scene.
-void R_InitFlatGlobals(float angle);
+void R_InitFlatGlobals(angle_t angle);
 
 void R_InitFlatBounds(void);
 
 void R_UpdateFlatBounds(void);
 
-// Draw a flat using the given floor or ceiling height and Y bounds.
-void R_DrawFlat(const flat_t *flat, const uint8_t *miny, const uint8_t *maxy, int32_t height);
+// Draw a flat using the given floor or ceiling height and Y bounds, in the
+// columns of the sector being drawn that are in the context's strip.
+void R_DrawFlat(renderctx_t *ctx, const flat_t *flat, const uint8_t *miny, const uint8_t *maxy, int32_t height);
 
 #endif
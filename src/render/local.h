@@ -2,11 +2,19 @@
 #define BRUTE_R_LOCAL_H
 
 /**
- * Global variables and constants used exclusively by the render module.
+ * Global variables, constants and state used exclusively by the render module.
+ * Globals are set up by the main thread before drawing and are read-only while
+ * drawing. Everything that changes while drawing is kept in a render context,
+ * one per strip of the screen, so that strips can be drawn at the same time.
  */
 
+#include "video.h"
 #include "map/defs.h"
+#include "render/draw.h"
 #include "render/fixed.h"
+#include "render/main.h"
+
+#include <stdbool.h>
 
 // Half of screen width.
 #define SCRNDIST 200.0f
@@ -14,15 +22,129 @@
 // Half of screen width as integer.
 #define SCRNDISTI 200
 
-extern uint16_t wallminx;   // Minimum X screen coordinate of wall, inclusive.
-extern uint16_t wallmaxx;   // Maximum X screen coordinate of wall, exclusive.
-extern uint16_t sectorxmin; // Minimum X screen coordinate of sector, inclusive.
-extern uint16_t sectorxmax; // Maximum X screen coordinate of sector, exclusive.
+// Maximum number of viswalls per strip.
+#define MAXVISWALLS 128
+
+// Maximum number of sectors on the stack.
+#define MAXSECTORDEPTH 32
+
+// Maximum number of sectors with actors visited per strip.
+#define MAXVISSECTORS 256
+
+// Maximum number of distinct textures drawn per strip.
+#define MAXTEXUSES 256
+
+// Size of clipping buffer, shared between strips by width. When a strip's
+// share is exhausted, no more sprites are clipped against walls in it.
+#define CLIPBUFSIZE 131072
+
+// Contains a pointer to a drawn wall and its X and Y bounds.
+typedef struct {
+    const wall_t *wall;   // Wall that this viswall represents.
+    uint16_t minx;        // Left X coordinate of portal, inclusive.
+    uint16_t maxx;        // Right X coordinate of portal, exclusive.
+    const uint8_t *miny;  // Minimum Y clipping bounds, inclusive.
+    const uint8_t *maxy;  // Maximum Y clipping bounds, exclusive.
+} viswall_t;
+
+// A sector waiting to be drawn.
+typedef struct {
+    const sector_t *sector;
+    uint16_t left, right;
+} sectorstack_t;
+
+// A texture drawn by a strip, to be marked as used by the main thread.
+typedef struct {
+    const void *texture; // The patch or flat.
+    bool flat;           // True if a flat.
+} texuse_t;
 
-extern const sector_t *rendersector; // Sector being rendered.
+// Render state of a strip.
+typedef struct {
+    // Columns of the strip, left inclusive and right exclusive.
+    uint16_t stripmin, stripmax;
+    // Index of the strip, from left to right.
+    uint8_t strip;
+    // If true, the strip is drawn on the main thread, so it may use the
+    // profiler.
+    bool profile;
+
+    // Sector being rendered.
+    const sector_t *rendersector;
+    // Screen X bounds of the sector, left inclusive and right exclusive.
+    uint16_t sectorxmin, sectorxmax;
+    // Bounds of the sector within the strip.
+    uint16_t drawxmin, drawxmax;
+    // Stack of sectors to draw.
+    sectorstack_t sectorstack[MAXSECTORDEPTH];
+
+    // The current wall.
+    const wall_t *renderwall;
+    // Screen X bounds of the wall.
+    uint16_t renderxmin, renderxmax;
+    // Bounds of the wall within the strip.
+    uint16_t wallminx, wallmaxx;
+    // Heights of wall ceiling and floor.
+    fixed_t heightceiling, heightfloor;
+    // Heights of sector ceiling and floor.
+    fixed_t sectorceiling, sectorfloor;
+    // Distances of the left and right sides of the wall.
+    int32_t distleft, distright;
+    // Left and right UV X coordinates.
+    int32_t uvleft, uvright;
+    // Y bounds for portal clipping.
+    uint8_t clipminy[SCREENWIDTH];
+    uint8_t clipmaxy[SCREENWIDTH];
+    // Previous clip bounds.
+    uint8_t prevminy[SCREENWIDTH];
+    uint8_t prevmaxy[SCREENWIDTH];
+    // Current bounds of wall.
+    uint8_t nextminy[SCREENWIDTH];
+    uint8_t nextmaxy[SCREENWIDTH];
+
+    // Heights of the flat being drawn, rotated, and its absolute height.
+    fixed_t heightcos, heightsin, flatheight;
+    // Shade gap of the flat being drawn.
+    uint8_t flatshadegap;
+    // Start of the span on each row of the flat being drawn.
+    uint16_t spanstart[SCREENHEIGHT];
+
+    // The strip's share of the clipping buffer, and the bytes used of it.
+    uint8_t *clipbuffer;
+    size_t clipbufsize;
+    size_t numclipbytes;
+    // Walls drawn, for clipping sprites.
+    uint8_t numviswalls;
+    viswall_t viswalls[MAXVISWALLS];
+    // Sprite Y bounds, inclusive and exclusive.
+    uint8_t spriteminy[SCREENWIDTH];
+    uint8_t spritemaxy[SCREENWIDTH];
+
+    // Sectors with actors that were visited, and textures that were drawn,
+    // for the main thread to handle after drawing.
+    uint16_t numvissectors;
+    const sector_t *vissectors[MAXVISSECTORS];
+    uint16_t numtexuses;
+    texuse_t texuses[MAXTEXUSES];
+
+    // Parameters of the drawing routines.
+    drawcolumn_t dc;
+    drawspan_t ds;
+
+    // Counts of what was drawn.
+    renderstats_t stats;
+    // Counts of what did not fit, for the main thread to warn about.
+    uint16_t lostviswalls;
+    uint16_t lostclipwalls;
+    uint16_t lostportals;
+    uint16_t lostsectors;
+    uint16_t losttexuses;
+} renderctx_t;
 
 extern vector_t renderpos; // Position scene is rendered at.
 
 extern fixed_t rendereyeheight; // Eye height to render at.
 
+extern renderstats_t renderstats; // Counts of what was drawn this frame.
+
 #endif
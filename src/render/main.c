@@ -1,37 +1,182 @@
+#include "log.h"
+#include "profile.h"
+#include "tic.h"
 #include "video.h"
 #include "system.h"
+#include "zone.h"
+#include "asset/texture.h"
+#include "map/map.h"
 #include "render/actor.h"
 #include "render/draw.h"
 #include "render/flat.h"
 #include "render/local.h"
 #include "render/main.h"
 #include "render/sector.h"
+#include "render/thread.h"
 #include "render/wall.h"
+#include "util/angle.h"
+#include "util/list.h"
 
-#include <math.h>
+#include <string.h>
 
-#define TAU 6.2831853f
+// Length of a view bobbing cycle, in tics.
+#define BOBTICS 18
+
+// A buffer of clipping bounds, shared between the strips. Used to clip sprites.
+static uint8_t clipbuffer[CLIPBUFSIZE];
+
+// Render contexts of each strip, from left to right.
+static renderctx_t *contexts;
+static uint8_t numstrips;
 
 // Calculate view bobbing.
 static float ViewBobbing(const actor_t *actor) {
     // Calculate where in animation we are.
-    // TODO don't rely on system time, use in-game tics instead.
-    float animangle = (playdate->system->getCurrentTimeMilliseconds() & 511) * (TAU / 512.0f);
+    float animtime = (gametic % BOBTICS) + ticfrac;
+    angle_t animangle = (angle_t) (animtime * (4294967296.0f / BOBTICS));
     // Figure out the intensity of view bobbing.
     float mag = U_VecLenSq(&actor->vel) * 0.1f;
-    return cosf(animangle) * mag;
+    return U_Cosine(animangle) * mag;
+}
+
+void R_SetStrips(int count) {
+    if (count < 1) {
+        count = 1;
+    } else if (count > MAXSTRIPS) {
+        count = MAXSTRIPS;
+    }
+    if (count == numstrips) {
+        return;
+    }
+    Z_Free(contexts);
+    contexts = Z_Malloc(sizeof(renderctx_t) * count, PU_STATIC, NULL, ZS_RENDER);
+    numstrips = count;
+    for (uint8_t i = 0; i < count; i++) {
+        renderctx_t *ctx = &contexts[i];
+        ctx->strip = i;
+        ctx->stripmin = (SCREENWIDTH / 8 * i / count) * 8;
+        ctx->stripmax = (SCREENWIDTH / 8 * (i + 1) / count) * 8;
+        // Each strip gets a share of the clip buffer proportional to its width.
+        size_t start = (size_t) CLIPBUFSIZE * ctx->stripmin / SCREENWIDTH;
+        size_t end = (size_t) CLIPBUFSIZE * ctx->stripmax / SCREENWIDTH;
+        ctx->clipbuffer = &clipbuffer[start];
+        ctx->clipbufsize = end - start;
+    }
+}
+
+uint8_t R_GetStrips(void) {
+    return numstrips;
+}
+
+// Draw the sectors of a strip.
+static void DrawStripSectors(void *data, uint32_t index) {
+    R_DrawSector(&contexts[index], data);
+}
+
+// Draw the actors of a strip.
+static void DrawStripActors(void *data, uint32_t index) {
+    R_DrawActors(&contexts[index]);
+}
+
+// Do what the strips can't do while drawing: mark the textures they drew as
+// used, and queue the actors in the sectors they visited. Strips are handled
+// in order, and a texture drawn by several strips is only marked for the
+// first, so the result does not depend on which thread drew which strip.
+static void FinishStrips(void) {
+    uint32_t lostviswalls = 0;
+    uint32_t lostclipwalls = 0;
+    uint32_t lostportals = 0;
+    uint32_t lostsectors = 0;
+    uint32_t losttexuses = 0;
+    R_ClearActors();
+    for (uint8_t i = 0; i < numstrips; i++) {
+        const renderctx_t *ctx = &contexts[i];
+        for (uint16_t j = 0; j < ctx->numtexuses; j++) {
+            const texuse_t *use = &ctx->texuses[j];
+            if (!W_FirstDrawnBy(use->texture, i)) {
+                continue;
+            }
+            if (use->flat) {
+                W_UseFlat(use->texture);
+            } else {
+                W_UsePatch(use->texture);
+            }
+        }
+        for (uint16_t j = 0; j < ctx->numvissectors; j++) {
+            // Add all actors in this sector to actor drawing queue.
+            listiter_t iter;
+            listiter_init(&iter, &ctx->vissectors[j]->actors);
+            actor_t *actor;
+            while ((actor = (actor_t *) listiter_next(&iter))) {
+                R_AddActor(actor);
+            }
+        }
+        lostviswalls += ctx->lostviswalls;
+        lostclipwalls += ctx->lostclipwalls;
+        lostportals += ctx->lostportals;
+        lostsectors += ctx->lostsectors;
+        losttexuses += ctx->losttexuses;
+    }
+    R_SortActors();
+
+    if (lostviswalls != 0) {
+        Y_WARN(YM_VISWALLS, lostviswalls);
+    }
+    if (lostclipwalls != 0) {
+        Y_WARN(YM_CLIPBUFFER, lostclipwalls);
+    }
+    if (lostportals != 0) {
+        Y_WARN(YM_SECTORDEPTH, lostportals);
+    }
+    if (lostsectors != 0) {
+        Y_WARN(YM_VISSECTORS, lostsectors);
+    }
+    if (losttexuses != 0) {
+        Y_WARN(YM_TEXUSES, losttexuses);
+    }
 }
 
 void render_viewpoint(const actor_t *actor) {
+    memset(&renderstats, 0, sizeof(renderstats));
+    // Interpolate the viewpoint between the last two tics.
+    float eyeheight, angle;
+    actor_lerp(actor, ticfrac, &renderpos, &eyeheight, &angle);
     // Init state of each submodule.
-    U_VecCopy(&renderpos, &actor->pos);    
-    float eyeheight = actor->zpos;
     eyeheight += 32.0f;
     eyeheight += ViewBobbing(actor);
-    R_InitWallGlobals(actor->angle, eyeheight);
-    R_InitFlatGlobals(actor->angle);
-    // Draw the sector that the actor is in.
-    R_DrawSector(actor->sector, 0, SCREENWIDTH);
+    angle_t viewangle = U_AngleFromRadians(angle);
+    R_InitWallGlobals(viewangle, eyeheight);
+    R_InitFlatGlobals(viewangle);
+    if (contexts == NULL) {
+        R_SetStrips(1);
+    }
+    // The profiler can only time the main thread, so the stages inside the
+    // strips are only timed when there are no other threads.
+    bool profile = R_GetRenderThreads() <= 1;
+    for (uint8_t i = 0; i < numstrips; i++) {
+        contexts[i].profile = profile;
+    }
+    W_BeginDraw();
+    PROF_BEGIN(PROF_SECTORS);
+    // Draw the sector that the viewpoint is in, which may differ from the
+    // actor's sector while interpolating.
+    R_ParallelFor(DrawStripSectors, M_FindSector(actor->sector, &renderpos), numstrips);
+    FinishStrips();
     // Draw actors on top of the level geometry.
-    R_DrawActors();
+    PROF_BEGIN(PROF_ACTORS);
+    R_ParallelFor(DrawStripActors, NULL, numstrips);
+    PROF_END(PROF_ACTORS);
+    PROF_END(PROF_SECTORS);
+    for (uint8_t i = 0; i < numstrips; i++) {
+        const renderstats_t *stats = &contexts[i].stats;
+        renderstats.sectors += stats->sectors;
+        renderstats.walls += stats->walls;
+        renderstats.columns += stats->columns;
+        renderstats.spans += stats->spans;
+        renderstats.actors += stats->actors;
+    }
+}
+
+void R_GetRenderStats(renderstats_t *stats) {
+    *stats = renderstats;
 }
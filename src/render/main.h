@@ -3,11 +3,41 @@
 
 /**
  * Main rendering routines.
+ *
+ * The screen can be split into vertical strips, each drawn on its own with the
+ * sectors, walls and sprites clipped to its columns. With RENDER_THREADS, the
+ * strips are drawn by several threads at once. The result is the same for any
+ * number of threads.
  */
 
+#include "video.h"
 #include "actor/actor.h"
 
+// Maximum number of strips. Strips are a multiple of eight columns wide, so
+// that no two strips write to the same byte of the framebuffer.
+#define MAXSTRIPS (SCREENWIDTH / 8)
+
+// Counts of what was drawn in the last frame. Sectors, walls and actors in
+// more than one strip are counted once for each.
+typedef struct {
+    uint32_t sectors; // Number of sectors visited.
+    uint32_t walls;   // Number of walls drawn, including portals.
+    uint32_t columns; // Number of columns drawn, for walls and sprites.
+    uint32_t spans;   // Number of spans drawn.
+    uint32_t actors;  // Number of actors drawn.
+} renderstats_t;
+
 // Render at the viewpoint of the given actor.
 void render_viewpoint(const actor_t *actor);
 
+// Set the number of strips to split the screen into, clamped to 1 to
+// MAXSTRIPS. Defaults to 1.
+void R_SetStrips(int count);
+
+// Get the number of strips.
+uint8_t R_GetStrips(void);
+
+// Get what was drawn in the last frame.
+void R_GetRenderStats(renderstats_t *stats);
+
 #endif
@@ -5,63 +5,62 @@
 #include "render/sector.h"
 #include "render/wall.h"
 
-#include <math.h>
+#include <string.h>
 
-typedef struct {
-    const sector_t *sector;
-    float left, right;
-} sectorstack_t;
-
-// Maximum number of sectors on the stack.
-#define MAXSECTORDEPTH 32
-
-// Size of clipping buffer. When exhausted, no more sprites are drawn.
-#define CLIPBUFSIZE 131072
-
-// A buffer of clipping bounds. Used to clip sprites.
-static uint8_t clipbuffer[CLIPBUFSIZE];
-// Number of bytes allocated for clipbuffer.
-static size_t numclipbytes;
-
-void R_DrawSector(sector_t *sector, uint16_t left, uint16_t right) {
+void R_DrawSector(renderctx_t *ctx, const sector_t *sector) {
     // Stack of sector data.
-    static sectorstack_t sectorstack[MAXSECTORDEPTH];
+    sectorstack_t *sectorstack = ctx->sectorstack;
 
-    numclipbytes = 0;
+    ctx->numclipbytes = 0;
+    ctx->numvissectors = 0;
+    ctx->numtexuses = 0;
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->lostviswalls = 0;
+    ctx->lostclipwalls = 0;
+    ctx->lostportals = 0;
+    ctx->lostsectors = 0;
+    ctx->losttexuses = 0;
 
-    R_ClearActors();
-    R_ClearViswalls();
+    R_ClearViswalls(ctx);
+    R_InitWallBounds(ctx);
 
     // Initialize stack.
     uint8_t depth = 1;
     sectorstack[0].sector = sector;
-    sectorstack[0].left = left;
-    sectorstack[0].right = right;
+    sectorstack[0].left = 0;
+    sectorstack[0].right = SCREENWIDTH;
 
     // Recursive stack drawing.
     do {
         // Pop from stack.
         --depth;
-        rendersector = sectorstack[depth].sector;
-        sectorxmin = sectorstack[depth].left;
-        sectorxmax = sectorstack[depth].right;
-        uint16_t sectorsize = sectorxmax - sectorxmin;
-        R_WallSectorHeight();
-        R_WallYBoundsUpdate();
+        const sector_t *rendersector = sectorstack[depth].sector;
+        ctx->rendersector = rendersector;
+        ctx->sectorxmin = sectorstack[depth].left;
+        ctx->sectorxmax = sectorstack[depth].right;
+        // Only portals that reach into the strip are pushed, so this is never
+        // empty.
+        ctx->drawxmin = ctx->sectorxmin > ctx->stripmin ? ctx->sectorxmin : ctx->stripmin;
+        ctx->drawxmax = ctx->sectorxmax < ctx->stripmax ? ctx->sectorxmax : ctx->stripmax;
+        ++ctx->stats.sectors;
+        uint16_t sectorsize = ctx->drawxmax - ctx->drawxmin;
+        R_WallSectorHeight(ctx);
+        R_WallYBoundsUpdate(ctx);
         // Check each wall in the sector.
         // Get pointers to clipping bounds.
         uint8_t *clipbuf = NULL;
-        if (numclipbytes + (sectorsize * 2) <= CLIPBUFSIZE) {
+        if (ctx->numclipbytes + (sectorsize * 2) <= ctx->clipbufsize) {
             // Allocate clip buffer.
-            clipbuf = &clipbuffer[numclipbytes];
-            numclipbytes += sectorsize * 2;
+            clipbuf = &ctx->clipbuffer[ctx->numclipbytes];
+            ctx->numclipbytes += sectorsize * 2;
         }
         for (size_t i = 0; i < rendersector->num_walls; i++) {
             const wall_t *wall = &rendersector->walls[i];
             // Bounds of wall.
             uint16_t nleft, nright;
             // Draw wall if possible.
-            if (R_DrawWall(wall, &nleft, &nright)) {
+            if (R_DrawWall(ctx, wall, &nleft, &nright)) {
+                ++ctx->stats.walls;
                 // If a portal, add to stack.
                 if (wall->portal != NULL) {
                     if (__builtin_expect(depth < MAXSECTORDEPTH, 0)) {
@@ -69,40 +68,43 @@ void R_DrawSector(sector_t *sector, uint16_t left, uint16_t right) {
                         sectorstack[depth].left = nleft;
                         sectorstack[depth].right = nright;
                         depth++;
+                    } else {
+                        ++ctx->lostportals;
                     }
                 }
                 // Allocate and build viswall if the wall's drawn.
                 if (clipbuf != NULL) {
-                    viswall_t *viswall = R_NewViswall();
+                    viswall_t *viswall = R_NewViswall(ctx);
                     if (viswall != NULL) {
                         viswall->wall = wall;
-                        viswall->minx = wallminx;
-                        viswall->maxx = wallmaxx;
-                        viswall->miny = &clipbuf[wallminx - sectorxmin];
+                        viswall->minx = ctx->wallminx;
+                        viswall->maxx = ctx->wallmaxx;
+                        viswall->miny = &clipbuf[ctx->wallminx - ctx->drawxmin];
                         viswall->maxy = viswall->miny + sectorsize;
+                    } else {
+                        ++ctx->lostviswalls;
                     }
+                } else {
+                    ++ctx->lostclipwalls;
                 }
             }
         }
         // If we have clip buffer, fill it with the new clip bounds.
         if (clipbuf != NULL) {
-            R_CopyClipBounds(clipbuf);
+            R_CopyClipBounds(ctx, clipbuf);
         }
         // Draw the floor and ceiling.
         // Note for later: It's bugged. Oops!
         // Note from later: How? Looks fine to me!
-        R_DrawWallFlats();
+        R_DrawWallFlats(ctx);
 
-        // Add all actors in this sector to actor drawing queue.
-        listiter_t iter;
-        listiter_init(&iter, &rendersector->actors);
-        actor_t *actor;
-
-        // For each actor...
-        while ((actor = (actor_t *) listiter_next(&iter))) {
-            R_AddActor(actor);
+        // Remember the sector so its actors are drawn.
+        if (rendersector->actors.next != &rendersector->actors) {
+            if (ctx->numvissectors < MAXVISSECTORS) {
+                ctx->vissectors[ctx->numvissectors++] = rendersector;
+            } else {
+                ++ctx->lostsectors;
+            }
         }
     } while (depth != 0);
-
-    R_DrawActors();
 }
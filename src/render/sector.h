@@ -6,8 +6,11 @@
  */
 
 #include "map/defs.h"
+#include "render/local.h"
 
-// Draw a sector.
-void R_DrawSector(sector_t *sector, uint16_t left, uint16_t right);
+// Draw the walls and flats of a sector and the sectors seen through it, in the
+// columns of the context's strip. The sectors with actors that were visited
+// are left in the context for the actors to be queued.
+void R_DrawSector(renderctx_t *ctx, const sector_t *sector);
 
 #endif
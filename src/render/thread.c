@@ -0,0 +1,141 @@
+#include "render/thread.h"
+
+#ifdef RENDER_THREADS
+
+#include "log.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Guards everything below except nextitem.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Signalled when there is a new job or the workers should quit.
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+// Signalled when the last worker finishes a job.
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+
+static pthread_t workers[MAXRENDERTHREADS - 1];
+// Number of threads, including the main thread.
+static uint8_t numthreads = 1;
+// Incremented for each job, so workers can tell a new job from a spurious
+// wakeup.
+static uint32_t generation;
+// Number of workers that have not finished the current job.
+static uint8_t working;
+// Set to make the workers exit.
+static bool quit;
+
+// The current job.
+static parallelfunc_t jobfunc;
+static void *jobdata;
+static uint32_t jobcount;
+// Next item of the job to take.
+static atomic_uint_fast32_t nextitem;
+
+// Take and run items of the current job until there are none left.
+static void RunItems(void) {
+    uint32_t index;
+    while ((index = atomic_fetch_add_explicit(&nextitem, 1, memory_order_relaxed)) < jobcount) {
+        jobfunc(jobdata, index);
+    }
+}
+
+static void *Worker(void *arg) {
+    // The generation when the worker was started, so it doesn't miss a job
+    // that starts before it first takes the lock.
+    uint32_t seen = (uint32_t) (uintptr_t) arg;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (generation == seen && !quit) {
+            pthread_cond_wait(&wake, &lock);
+        }
+        if (quit) {
+            break;
+        }
+        seen = generation;
+        pthread_mutex_unlock(&lock);
+        RunItems();
+        pthread_mutex_lock(&lock);
+        if (--working == 0) {
+            pthread_cond_signal(&done);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+// Stop and join all workers.
+static void StopWorkers(void) {
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+    for (uint8_t i = 0; i < numthreads - 1; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    quit = false;
+    numthreads = 1;
+}
+
+void R_ParallelFor(parallelfunc_t func, void *data, uint32_t count) {
+    if (numthreads <= 1 || count <= 1) {
+        for (uint32_t i = 0; i < count; i++) {
+            func(data, i);
+        }
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    jobfunc = func;
+    jobdata = data;
+    jobcount = count;
+    atomic_store_explicit(&nextitem, 0, memory_order_relaxed);
+    working = numthreads - 1;
+    ++generation;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+    RunItems();
+    pthread_mutex_lock(&lock);
+    while (working != 0) {
+        pthread_cond_wait(&done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void R_SetRenderThreads(int count) {
+    if (count < 1) {
+        count = 1;
+    } else if (count > MAXRENDERTHREADS) {
+        count = MAXRENDERTHREADS;
+    }
+    if (count == numthreads) {
+        return;
+    }
+    StopWorkers();
+    for (uint8_t i = 0; i < count - 1; i++) {
+        if (pthread_create(&workers[i], NULL, Worker, (void *) (uintptr_t) generation) != 0) {
+            Y_Error("R_SetRenderThreads: Failed to start thread %d", i + 1);
+        }
+        numthreads = i + 2;
+    }
+}
+
+uint8_t R_GetRenderThreads(void) {
+    return numthreads;
+}
+
+#else
+
+void R_ParallelFor(parallelfunc_t func, void *data, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        func(data, i);
+    }
+}
+
+void R_SetRenderThreads(int count) {}
+
+uint8_t R_GetRenderThreads(void) {
+    return 1;
+}
+
+#endif
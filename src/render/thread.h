@@ -0,0 +1,33 @@
+#ifndef BRUTE_R_THREAD_H
+#define BRUTE_R_THREAD_H
+
+/**
+ * A pool of threads for the renderer. The Playdate has one core, so threads
+ * are only used when RENDER_THREADS is defined, as in the host build. Without
+ * it, work is done on the calling thread, one item at a time in order.
+ *
+ * Items are not assigned to threads up front. Each thread takes the next item
+ * that nobody has taken yet, so a thread that finishes a cheap item moves on
+ * to the next instead of waiting for a slow one.
+ */
+
+#include "types.h"
+
+// Maximum number of threads, including the main thread.
+#define MAXRENDERTHREADS 16
+
+// Work on one item.
+typedef void (*parallelfunc_t)(void *data, uint32_t index);
+
+// Call func for each index from 0 to count, exclusive, spread over the
+// threads, and wait for all calls to return. The main thread takes part.
+void R_ParallelFor(parallelfunc_t func, void *data, uint32_t count);
+
+// Set the number of threads, including the main thread, clamped to 1 to
+// MAXRENDERTHREADS. Always 1 without RENDER_THREADS.
+void R_SetRenderThreads(int count);
+
+// Get the number of threads, including the main thread.
+uint8_t R_GetRenderThreads(void);
+
+#endif
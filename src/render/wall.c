@@ -1,4 +1,6 @@
+#include "profile.h"
 #include "video.h"
+#include "asset/texture.h"
 #include "render/draw.h"
 #include "render/flat.h"
 #include "render/local.h"
@@ -8,24 +10,8 @@
 #include <math.h>
 #include <string.h>
 
-static uint16_t renderxmin; // Minimum X coordinate of wall, inclusive.
-static uint16_t renderxmax; // Maximum X coordinate of wall, exclusive.
-
-static const wall_t *renderwall; // The current wall.
-static float wallsine;           // Sine multiply for wall rotation.
-static float wallcosine;         // Cosine multiply for wall rotation.
-
-static fixed_t heightceiling; // Height of wall ceiling.
-static fixed_t heightfloor;   // Height of wall floor.
-
-static fixed_t sectorceiling; // Height of sector ceiling.
-static fixed_t sectorfloor;   // Height of sector floor.
-
-static int32_t distleft;  // Distance of left side of wall.
-static int32_t distright; // Distance of right side of wall.
-
-static int32_t uvleft;  // Left UV X coordinate.
-static int32_t uvright; // Right UV X coordinate.
+static float wallsine;   // Sine multiply for wall rotation.
+static float wallcosine; // Cosine multiply for wall rotation.
 
 // Enum for how to clip sector bounds.
 typedef enum {
@@ -36,19 +22,36 @@ typedef enum {
     CLIP_WALLFLOOR, // Clip the floor Y bounds for a wall or portal.
 } cliptype_t;
 
-// Y bounds for portal clipping.
-static uint8_t clipminy[SCREENWIDTH];
-static uint8_t clipmaxy[SCREENWIDTH];
+// Record a texture drawn by a strip, unless this strip or an earlier one
+// already has.
+static void UseTexture(renderctx_t *ctx, const void *texture, bool flat) {
+    if (texture == NULL || !W_MarkDrawn(texture, ctx->strip)) {
+        return;
+    }
+    if (ctx->numtexuses == MAXTEXUSES) {
+        ++ctx->losttexuses;
+        return;
+    }
+    texuse_t *use = &ctx->texuses[ctx->numtexuses++];
+    use->texture = texture;
+    use->flat = flat;
+}
 
-// Previous clip bounds.
-static uint8_t prevminy[SCREENWIDTH];
-static uint8_t prevmaxy[SCREENWIDTH];
+// Get a patch to draw, recording its use.
+static const patch_t *UsePatch(renderctx_t *ctx, const patch_t *patch) {
+    UseTexture(ctx, patch, false);
+    return W_ResidentPatch(patch);
+}
 
-// Current bounds of wall.
-static uint8_t nextminy[SCREENWIDTH];
-static uint8_t nextmaxy[SCREENWIDTH];
+// Get a flat to draw, recording its use.
+static const flat_t *UseFlat(renderctx_t *ctx, const flat_t *flat) {
+    UseTexture(ctx, flat, true);
+    return W_ResidentFlat(flat);
+}
 
-static void TryClip(cliptype_t cliptype, uint8_t val, int32_t x) {
+static void TryClip(renderctx_t *ctx, cliptype_t cliptype, uint8_t val, int32_t x) {
+    uint8_t *clipminy = ctx->clipminy;
+    uint8_t *clipmaxy = ctx->clipmaxy;
     switch (cliptype) {
         case CLIP_NONE:
             break;
@@ -64,13 +67,13 @@ static void TryClip(cliptype_t cliptype, uint8_t val, int32_t x) {
             break;
         case CLIP_WALLCEIL:
             if (val > clipminy[x]) {
-                nextminy[x] = val;
+                ctx->nextminy[x] = val;
                 clipminy[x] = val;
             }
             break;
         case CLIP_WALLFLOOR:
             if (val < clipmaxy[x]) {
-                nextmaxy[x] = val;
+                ctx->nextmaxy[x] = val;
                 clipmaxy[x] = val;
             }
             break;
@@ -83,32 +86,39 @@ void R_RotatePoint(vector_t *v) {
     v->x = x;
 }
 
-static uint8_t ClipYPoint(int32_t y, int32_t x) {
-    if (y < clipminy[x]) {
-        return clipminy[x];
-    } else if (y > clipmaxy[x]) {
-        return clipmaxy[x];
+static uint8_t ClipYPoint(const renderctx_t *ctx, int32_t y, int32_t x) {
+    if (y < ctx->clipminy[x]) {
+        return ctx->clipminy[x];
+    } else if (y > ctx->clipmaxy[x]) {
+        return ctx->clipmaxy[x];
     }
     return y;
 }
 
-static void SetColumnOffset(int32_t height, const patch_t *patch) {
+static void SetColumnOffset(renderctx_t *ctx, int32_t height, const patch_t *patch) {
     if (patch != NULL) {
-        dc_offset = (renderwall->yoffset << FRACBITS) -
+        ctx->dc.offset = (ctx->renderwall->yoffset << FRACBITS) -
             (height & (((1 << FRACBITS) - 1) | ((patch->height - 1) << FRACBITS)));
     }
 }
 
 static void DrawWallColumns(
+    renderctx_t *ctx,
     const patch_t *patch,
     cliptype_t ceilclip,
     cliptype_t floorclip
 ) {
+    fixed_t heightceiling = ctx->heightceiling;
+    fixed_t heightfloor = ctx->heightfloor;
+    int32_t distleft = ctx->distleft;
+    int32_t distright = ctx->distright;
+    uint16_t renderxmin = ctx->renderxmin;
+    drawcolumn_t *dc = &ctx->dc;
     // Location of wall endpoints.
     fixed_t hfrac = ((SCRNDISTI * heightceiling) / distleft) + ((SCREENHEIGHT >> 1) << FRACBITS);
     fixed_t lfrac = ((SCRNDISTI * heightfloor) / distleft) + ((SCREENHEIGHT >> 1) << FRACBITS);
     // X distance to draw.
-    uint16_t dx = renderxmax - renderxmin;
+    uint16_t dx = ctx->renderxmax - renderxmin;
     // Factor to scale wall endpoint step values.
     int32_t stepnum = SCRNDISTI * (distleft - distright);
     int32_t stepden = distleft * distright * dx;
@@ -121,43 +131,51 @@ static void DrawWallColumns(
     fixed_t scalestep = stepfac << (INTBITS - FRACBITS);
     // Texture drawing values.
     int32_t uend = distright * dx;
-    int32_t du = distleft * (uvright - uvleft);
+    int32_t du = distleft * (ctx->uvright - ctx->uvleft);
     int32_t dz = distright - distleft;
     // Preset height of texture.
     if (patch != NULL) {
-        dc_height = patch->height;
+        dc->height = patch->height;
     }
+    // Skip to the first column in the strip. Step in unsigned arithmetic so
+    // that this wraps exactly as stepping one column at a time would.
+    uint16_t x = ctx->wallminx;
+    uint32_t skip = x - renderxmin;
+    hfrac = (uint32_t) hfrac + (uint32_t) hstep * skip;
+    lfrac = (uint32_t) lfrac + (uint32_t) lstep * skip;
+    scale = (uint32_t) scale + (uint32_t) scalestep * skip;
     // Wall drawing loop.
-    uint16_t x = renderxmin;
     do {
         // Find integer endpoints on screen.
-        uint8_t yh = ClipYPoint(hfrac >> FRACBITS, x);
-        uint8_t yl = ClipYPoint(lfrac >> FRACBITS, x);
+        uint8_t yh = ClipYPoint(ctx, hfrac >> FRACBITS, x);
+        uint8_t yl = ClipYPoint(ctx, lfrac >> FRACBITS, x);
         // Draw patch if present.
         if (patch != NULL) {
             // Calculate which column to render.
             uint16_t x1 = x - renderxmin;
             int32_t num = du * x1;
             int32_t den = uend - x1 * dz;
-            uint16_t whichx = ((uvleft + (num / den)) >> 4) & (patch->width - 1);
+            uint16_t whichx = ((ctx->uvleft + (num / den)) >> 4) & (patch->width - 1);
             // Set parameters.
-            dc_source = &patch->data[whichx * patch->height];
-            dc_scale = 0xffffffffu / (uint32_t) scale;
-            dc_x = x;
-            dc_yh = yh;
-            dc_yl = yl;
+            dc->source = &patch->data[whichx * PATCHCOLUMNBYTES(patch->height)];
+            dc->scale = 0xffffffffu / (uint32_t) scale;
+            dc->shades = R_ShadeTable(ctx->rendersector->light, ((int64_t) dc->scale * SCRNDISTI) >> FRACBITS, patch->shadegap);
+            dc->x = x;
+            dc->yh = yh;
+            dc->yl = yl;
             // Draw the column.
-            R_DrawColumn();
+            R_DrawColumn(dc);
+            ++ctx->stats.columns;
             // Advance scale.
             scale += scalestep;
         }
         // Update bounds.
-        TryClip(ceilclip, yh, x);
-        TryClip(floorclip, yl, x);
+        TryClip(ctx, ceilclip, yh, x);
+        TryClip(ctx, floorclip, yl, x);
         // Step accumulators.
         hfrac += hstep;
         lfrac += lstep;
-    } while (++x != renderxmax);
+    } while (++x != ctx->wallmaxx);
 }
 
 // Clip floating-point X bound to integer bound within range of screen (right side exclusive)
@@ -209,7 +227,8 @@ static float ClipEndpoint(
     }
 }
 
-static bool ClipWall(uint16_t *left, uint16_t *right) {
+static bool ClipWall(renderctx_t *ctx, uint16_t *left, uint16_t *right) {
+    const wall_t *renderwall = ctx->renderwall;
     // Find the corners of this wall.
     vector_t a, b;
     U_VecCopy(&a, renderwall->v1);
@@ -222,7 +241,7 @@ static bool ClipWall(uint16_t *left, uint16_t *right) {
     R_RotatePoint(&b);
     // Check clipping on left side of frustrum.
     clip_t cl;
-    cl.bound = sectorxmin - SCRNDIST;
+    cl.bound = ctx->sectorxmin - SCRNDIST;
     float al = (cl.bound * a.y) - (SCRNDIST * a.x);
     float bl = (SCRNDIST * b.x) - (cl.bound * b.y);
     if (al > 0.0f && bl < 0.0f) {
@@ -231,7 +250,7 @@ static bool ClipWall(uint16_t *left, uint16_t *right) {
     }
     // Check clipping on right side of frustrum.
     clip_t cr;
-    cr.bound = sectorxmax - SCRNDIST;
+    cr.bound = ctx->sectorxmax - SCRNDIST;
     float ar = (cr.bound * a.y) - (SCRNDIST * a.x);
     float br = (SCRNDIST * b.x) - (cr.bound * b.y);
     if (ar < 0.0f && br > 0.0f) {
@@ -273,91 +292,117 @@ static bool ClipWall(uint16_t *left, uint16_t *right) {
         return false;
     }
     // Finalize the integer endpoints of the rendered wall.
-    renderxmin = ClipToScreen(ncl);
-    renderxmax = ClipToScreen(ncr);
+    uint16_t renderxmin = ClipToScreen(ncl);
+    uint16_t renderxmax = ClipToScreen(ncr);
     // Stop if wall is empty.
     if (renderxmin >= renderxmax) {
         return false;
     }
+    ctx->renderxmin = renderxmin;
+    ctx->renderxmax = renderxmax;
     // Get the integer distance of the endpoints of the rendered wall.
-    distleft = ClipDist(a.y);
-    distright = ClipDist(b.y);
+    ctx->distleft = ClipDist(a.y);
+    ctx->distright = ClipDist(b.y);
     // Get the integer UV coordinates of the texture.
-    uvleft = floorf(ua * 16.0f);
-    uvright = floorf(ub * 16.0f);
-    // Update bounds if this is a portal.
+    ctx->uvleft = floorf(ua * 16.0f);
+    ctx->uvright = floorf(ub * 16.0f);
+    // Update bounds if this is a portal. Rounding can put the endpoints a
+    // column outside the sector, so keep the portal inside it, as strips do
+    // not draw sectors outside their columns.
     if (renderwall->portal != NULL) {
-        *left = renderxmin;
-        *right = renderxmax;
+        *left = renderxmin > ctx->sectorxmin ? renderxmin : ctx->sectorxmin;
+        *right = renderxmax < ctx->sectorxmax ? renderxmax : ctx->sectorxmax;
     }
     // Wall can be rendered!
     return true;
 }
 
-void R_InitWallGlobals(float angle, float eyeheight) {
+void R_InitWallGlobals(angle_t angle, float eyeheight) {
     // Precalculate sine and cosine.
-    wallsine = sinf(-angle);
-    wallcosine = cosf(-angle);
-    // Initialize min and max buffers.
-    memset(clipminy, 0, sizeof(clipminy));
-    memset(clipmaxy, SCREENHEIGHT, sizeof(clipmaxy));
-    memset(nextminy, 0, sizeof(clipminy));
-    memset(nextmaxy, SCREENHEIGHT, sizeof(clipmaxy));
+    wallsine = U_Sine(-angle);
+    wallcosine = U_Cosine(-angle);
     // Remember eye height.
     rendereyeheight = float_to_fixed(eyeheight);
 }
 
-void R_DrawWallFlats(void) {
-    R_DrawFlat(rendersector->ceilflat, prevminy, nextminy, sectorceiling);
-    R_DrawFlat(rendersector->floorflat, nextmaxy, prevmaxy, sectorfloor);
+void R_InitWallBounds(renderctx_t *ctx) {
+    uint16_t x = ctx->stripmin;
+    uint16_t width = ctx->stripmax - ctx->stripmin;
+    memset(&ctx->clipminy[x], 0, width);
+    memset(&ctx->clipmaxy[x], SCREENHEIGHT, width);
+    memset(&ctx->nextminy[x], 0, width);
+    memset(&ctx->nextmaxy[x], SCREENHEIGHT, width);
+}
+
+void R_DrawWallFlats(renderctx_t *ctx) {
+    // The profiler can only be used from the main thread.
+    if (ctx->profile) {
+        PROF_BEGIN(PROF_FLATS);
+    }
+    R_DrawFlat(ctx, UseFlat(ctx, ctx->rendersector->ceilflat), ctx->prevminy, ctx->nextminy, ctx->sectorceiling);
+    R_DrawFlat(ctx, UseFlat(ctx, ctx->rendersector->floorflat), ctx->nextmaxy, ctx->prevmaxy, ctx->sectorfloor);
+    if (ctx->profile) {
+        PROF_END(PROF_FLATS);
+    }
 }
 
-void R_WallSectorHeight(void) {
-    sectorceiling = rendereyeheight - (rendersector->ceiling << FRACBITS);
-    sectorfloor = rendereyeheight - (rendersector->floor << FRACBITS);
+void R_WallSectorHeight(renderctx_t *ctx) {
+    ctx->sectorceiling = rendereyeheight - (ctx->rendersector->ceiling << FRACBITS);
+    ctx->sectorfloor = rendereyeheight - (ctx->rendersector->floor << FRACBITS);
 }
 
-void R_WallYBoundsUpdate(void) {
-    memcpy(&prevminy[sectorxmin], &clipminy[sectorxmin], sectorxmax - sectorxmin);
-    memcpy(&prevmaxy[sectorxmin], &clipmaxy[sectorxmin], sectorxmax - sectorxmin);
+void R_WallYBoundsUpdate(renderctx_t *ctx) {
+    uint16_t x = ctx->drawxmin;
+    uint16_t width = ctx->drawxmax - ctx->drawxmin;
+    memcpy(&ctx->prevminy[x], &ctx->clipminy[x], width);
+    memcpy(&ctx->prevmaxy[x], &ctx->clipmaxy[x], width);
 }
 
-void R_CopyClipBounds(uint8_t *buf) {
-    memcpy(&buf[0], &clipminy[sectorxmin], sectorxmax - sectorxmin);
-    memcpy(&buf[sectorxmax - sectorxmin], &clipmaxy[sectorxmin], sectorxmax - sectorxmin);
+void R_CopyClipBounds(const renderctx_t *ctx, uint8_t *buf) {
+    uint16_t x = ctx->drawxmin;
+    uint16_t width = ctx->drawxmax - ctx->drawxmin;
+    memcpy(&buf[0], &ctx->clipminy[x], width);
+    memcpy(&buf[width], &ctx->clipmaxy[x], width);
 }
 
-bool R_DrawWall(const wall_t *wall, uint16_t *left, uint16_t *right) {
-    renderwall = wall;
+bool R_DrawWall(renderctx_t *ctx, const wall_t *wall, uint16_t *left, uint16_t *right) {
+    ctx->renderwall = wall;
 
-    if (!ClipWall(left, right)) {
+    if (!ClipWall(ctx, left, right)) {
         return false;
     }
 
-    // TODO remove these statics
-    wallminx = renderxmin;
-    wallmaxx = renderxmax;
+    // Only draw the columns in the sector and in the strip.
+    ctx->wallminx = ctx->renderxmin > ctx->drawxmin ? ctx->renderxmin : ctx->drawxmin;
+    ctx->wallmaxx = ctx->renderxmax < ctx->drawxmax ? ctx->renderxmax : ctx->drawxmax;
+    if (ctx->wallminx >= ctx->wallmaxx) {
+        return false;
+    }
 
-    heightceiling = sectorceiling;
-    heightfloor = sectorfloor;
+    const sector_t *rendersector = ctx->rendersector;
+    ctx->heightceiling = ctx->sectorceiling;
+    ctx->heightfloor = ctx->sectorfloor;
 
-    SetColumnOffset(heightceiling, renderwall->midpatch);
-    DrawWallColumns(renderwall->midpatch, CLIP_WALLCEIL, CLIP_WALLFLOOR);
+    const patch_t *midpatch = UsePatch(ctx, wall->midpatch);
+    SetColumnOffset(ctx, ctx->heightceiling, midpatch);
+    DrawWallColumns(ctx, midpatch, CLIP_WALLCEIL, CLIP_WALLFLOOR);
 
-    if (renderwall->portal != NULL) {
+    if (wall->portal != NULL) {
         // If the height of the ceiling goes down, render top wall.
-        if (renderwall->portal->ceiling < rendersector->ceiling) {
-            heightfloor = rendereyeheight - (renderwall->portal->ceiling << FRACBITS);
-            SetColumnOffset(heightfloor, renderwall->toppatch);
-            DrawWallColumns(renderwall->toppatch, CLIP_NONE, CLIP_STEPCEIL);
+        if (wall->portal->ceiling < rendersector->ceiling) {
+            ctx->heightfloor = rendereyeheight - (wall->portal->ceiling << FRACBITS);
+            const patch_t *toppatch = UsePatch(ctx, wall->toppatch);
+            SetColumnOffset(ctx, ctx->heightfloor, toppatch);
+            DrawWallColumns(ctx, toppatch, CLIP_NONE, CLIP_STEPCEIL);
         }
 
         // If the height of the floor goes up, render bottom wall.
-        if (renderwall->portal->floor > rendersector->floor) {
-            heightceiling = rendereyeheight - (renderwall->portal->floor << FRACBITS);
-            heightfloor = sectorfloor;
-            SetColumnOffset(heightceiling, renderwall->botpatch);
-            DrawWallColumns(renderwall->botpatch, CLIP_STEPFLOOR, CLIP_NONE);
+        if (wall->portal->floor > rendersector->floor) {
+            ctx->heightceiling = rendereyeheight - (wall->portal->floor << FRACBITS);
+            ctx->heightfloor = ctx->sectorfloor;
+            const patch_t *botpatch = UsePatch(ctx, wall->botpatch);
+            SetColumnOffset(ctx, ctx->heightceiling, botpatch);
+            DrawWallColumns(ctx, botpatch, CLIP_STEPFLOOR, CLIP_NONE);
         }
     }
 
@@ -6,19 +6,24 @@
  */
 
 #include "map/defs.h"
+#include "render/local.h"
+#include "util/angle.h"
 
 #include <stdbool.h>
 
 // Initialize globals used for wall rendering. Call once before drawing a scene.
-void R_InitWallGlobals(float angle, float eyeheight);
+void R_InitWallGlobals(angle_t angle, float eyeheight);
 
-void R_DrawWallFlats(void);
+// Initialize the clipping bounds of a strip. Call once before drawing a scene.
+void R_InitWallBounds(renderctx_t *ctx);
 
-void R_WallSectorHeight(void);
+void R_DrawWallFlats(renderctx_t *ctx);
 
-void R_WallYBoundsUpdate(void);
+void R_WallSectorHeight(renderctx_t *ctx);
 
-void R_CopyClipBounds(uint8_t *buf);
+void R_WallYBoundsUpdate(renderctx_t *ctx);
+
+void R_CopyClipBounds(const renderctx_t *ctx, uint8_t *buf);
 
 void R_RotatePoint(vector_t *v);
 
@@ -26,6 +31,8 @@ void R_RotatePoint(vector_t *v);
 // If the wall is a portal and its sector should be drawn, the bounds of the
 // portal are written in the given pointers and the function returns true.
 // Also returns true if the wall is not a portal, as long as it is drawn.
-bool R_DrawWall(const wall_t *wall, uint16_t *left, uint16_t *right);
+// Only the columns in the context's strip are drawn, and the function returns
+// false if there are none.
+bool R_DrawWall(renderctx_t *ctx, const wall_t *wall, uint16_t *left, uint16_t *right);
 
 #endif
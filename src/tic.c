@@ -0,0 +1,43 @@
+#include "system.h"
+#include "tic.h"
+
+uint32_t gametic;
+float    ticfrac;
+
+// Longest time counted in one update, in milliseconds. Keeps a long stall
+// from overflowing the accumulator.
+#define MAXELAPSEDMS 1000
+
+// Time of last update, in milliseconds.
+static uint32_t lastms;
+// Accumulated time, in thousandths of a tic.
+static uint32_t accumulator;
+
+void B_ClockReset(void) {
+    lastms = playdate->system->getCurrentTimeMilliseconds();
+    gametic = 0;
+    accumulator = 0;
+    ticfrac = 0.0f;
+}
+
+uint8_t B_ClockUpdate(void) {
+    uint32_t ms = playdate->system->getCurrentTimeMilliseconds();
+    uint32_t elapsed = ms - lastms;
+    if (elapsed > MAXELAPSEDMS) {
+        elapsed = MAXELAPSEDMS;
+    }
+    accumulator += elapsed * TICRATE;
+    lastms = ms;
+    // Count whole tics, dropping any beyond the limit.
+    uint32_t tics = accumulator / 1000;
+    accumulator %= 1000;
+    if (tics > MAXFRAMETICS) {
+        tics = MAXFRAMETICS;
+    }
+    ticfrac = accumulator * (1.0f / 1000.0f);
+    return tics;
+}
+
+void B_ClockTic(void) {
+    ++gametic;
+}
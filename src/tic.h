@@ -0,0 +1,32 @@
+#ifndef BRUTE_B_TIC_H
+#define BRUTE_B_TIC_H
+
+/**
+ * Fixed-rate simulation clock. Gameplay advances in whole tics at TICRATE,
+ * independently of the frame rate, and rendering interpolates between the
+ * previous and current tic using ticfrac.
+ */
+
+#include "types.h"
+
+// Number of simulation tics per second.
+#define TICRATE 35
+
+// Maximum number of tics run in a single frame. If the game falls further
+// behind than this, the remaining time is dropped.
+#define MAXFRAMETICS 4
+
+extern uint32_t gametic; // Number of tics simulated so far.
+extern float    ticfrac; // Fraction of a tic elapsed since the last tic, from 0 to 1.
+
+// Reset the clock to the first tic, discarding any accumulated time.
+void B_ClockReset(void);
+
+// Accumulate the time since the last update. Returns the number of tics that
+// should be simulated this frame.
+uint8_t B_ClockUpdate(void);
+
+// Mark a tic as simulated.
+void B_ClockTic(void);
+
+#endif
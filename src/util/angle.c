@@ -0,0 +1,11 @@
+#include "util/angle.h"
+
+#include <math.h>
+
+float finesine[FINEANGLES + FINEANGLES / 4];
+
+void U_InitAngles(void) {
+    for (uint32_t i = 0; i < FINEANGLES + FINEANGLES / 4; i++) {
+        finesine[i] = sinf(i * (6.2831853f / FINEANGLES));
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef BRUTE_U_ANGLE_H
+#define BRUTE_U_ANGLE_H
+
+/**
+ * Binary angles, where the full circle is 2^32, with table lookup sine and
+ * cosine.
+ */
+
+#include <stdint.h>
+
+// A binary angle. Wraps around naturally.
+typedef uint32_t angle_t;
+
+// Log2 of the number of angles in the sine table.
+#define FINEANGLEBITS 12
+
+// Number of angles in the sine table.
+#define FINEANGLES (1 << FINEANGLEBITS)
+
+// Shift to convert a binary angle to a sine table index.
+#define ANGLETOFINESHIFT (32 - FINEANGLEBITS)
+
+// Binary angle units per radian, 2^32 / tau.
+#define ANGLESPERRADIAN 683565275.6f
+
+// Sine table, extended by a quarter turn so cosine can be read from it.
+extern float finesine[FINEANGLES + FINEANGLES / 4];
+
+// Build the sine table. Call this before using U_Sine or U_Cosine.
+void U_InitAngles(void);
+
+// Convert an angle in radians to a binary angle.
+static inline angle_t U_AngleFromRadians(float radians) {
+    return (angle_t) (int64_t) (radians * ANGLESPERRADIAN);
+}
+
+// Get the sine of a binary angle.
+static inline float U_Sine(angle_t angle) {
+    return finesine[angle >> ANGLETOFINESHIFT];
+}
+
+// Get the cosine of a binary angle.
+static inline float U_Cosine(angle_t angle) {
+    return finesine[(angle >> ANGLETOFINESHIFT) + FINEANGLES / 4];
+}
+
+#endif
@@ -1,24 +1,39 @@
+#include "log.h"
 #include "system.h"
+#include "zone.h"
+#include "util/file.h"
 
-void *read_file(const char *path, size_t *size) {
+SDFile *open_file(const char *path, size_t *size) {
     // Open the file.
     SDFile *file = playdate->file->open(path, kFileRead | kFileReadData);
     if (file == NULL)
-        playdate->system->error("File '%s' not found", path);
+        Y_Error("File '%s' not found", path);
 
     // How big is the file? Only ask *after* we opened it to avoid TOCTOU
     FileStat stat;
     if (playdate->file->stat(path, &stat))
-        playdate->system->error("Failed to stat '%s'", path);
+        Y_Error("Failed to stat '%s'", path);
+
+    *size = stat.size;
+    return file;
+}
+
+void read_file_part(SDFile *file, void *buffer, size_t size, const char *path) {
+    if (playdate->file->read(file, buffer, size) != (int) size)
+        Y_Error("Failed to read entire file '%s'", path);
+}
+
+void *read_file(const char *path, size_t *size) {
+    size_t filesize;
+    SDFile *file = open_file(path, &filesize);
 
     // Create a buffer.
-    void *buffer = playdate->system->realloc(NULL, stat.size);
-    if (playdate->file->read(file, buffer, stat.size) != (int) stat.size)
-        playdate->system->error("Failed to read entire file '%s'", path);
+    void *buffer = Z_Malloc(filesize, PU_STATIC, NULL, ZS_MISC);
+    read_file_part(file, buffer, filesize, path);
 
     playdate->file->close(file);
 
     if (size != NULL)
-        *size = stat.size;
+        *size = filesize;
     return buffer;
 }
@@ -1,6 +1,8 @@
 #ifndef BRUTE_U_FILE_H
 #define BRUTE_U_FILE_H
 
+#include "system.h"
+
 #include <stddef.h>
 
 /**
@@ -8,7 +10,14 @@
  * generally throw an error on failure.
  */
 
-// Read a file, and optionally get its size. The returned pointer should be freed.
+// Open a file for reading and get its size. The file should be closed.
+SDFile *open_file(const char *path, size_t *size);
+
+// Read exactly size bytes from an open file. The path is used for errors.
+void read_file_part(SDFile *file, void *buffer, size_t size, const char *path);
+
+// Read a file, and optionally get its size. The returned pointer should be
+// freed with Z_Free.
 void *read_file(const char *path, size_t *size);
 
 #endif
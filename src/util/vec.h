@@ -2,9 +2,11 @@
 #define BRUTE_U_VEC_H
 
 /**
- * Support for 2-dimensional vectors.
+ * Support for 2-dimensional vectors. Everything is inline.
  */
 
+#include <math.h>
+
 // A two-dimensional point.
 typedef struct {
     float x;
@@ -12,30 +14,61 @@ typedef struct {
 } vector_t;
 
 // Copy a vector to another vector.
-void U_VecCopy(vector_t *dst, const vector_t *src);
+static inline void U_VecCopy(vector_t *dst, const vector_t *src) {
+    dst->x = src->x;
+    dst->y = src->y;
+}
 
 // Add a vector to another vector.
-void U_VecAdd(vector_t *dst, const vector_t *src);
+static inline void U_VecAdd(vector_t *dst, const vector_t *src) {
+    dst->x += src->x;
+    dst->y += src->y;
+}
 
 // Subtract a vector from another vector.
-void U_VecSub(vector_t *dst, const vector_t *src);
+static inline void U_VecSub(vector_t *dst, const vector_t *src) {
+    dst->x -= src->x;
+    dst->y -= src->y;
+}
 
 // Scale a vector by a given factor.
-void U_VecScale(vector_t *vtx, float scale);
+static inline void U_VecScale(vector_t *vtx, float scale) {
+    vtx->x *= scale;
+    vtx->y *= scale;
+}
 
 // Add a vector to another vector with a given scale.
-void U_VecScaledAdd(vector_t *dst, const vector_t *src, float scale);
+static inline void U_VecScaledAdd(vector_t *dst, const vector_t *src, float scale) {
+    dst->x = fmaf(src->x, scale, dst->x);
+    dst->y = fmaf(src->y, scale, dst->y);
+}
 
 // Get the dot product of two vectors.
-float U_VecDot(const vector_t *a, const vector_t *b);
+static inline float U_VecDot(const vector_t *a, const vector_t *b) {
+    return a->x * b->x + a->y * b->y;
+}
 
 // Get the squared length of a vector.
-float U_VecLenSq(const vector_t *vtx);
+static inline float U_VecLenSq(const vector_t *vtx) {
+    return U_VecDot(vtx, vtx);
+}
 
 // Get the squared distance between two vectors.
-float U_VecDistSq(const vector_t *a, const vector_t *b);
+static inline float U_VecDistSq(const vector_t *a, const vector_t *b) {
+    vector_t delta;
+    U_VecCopy(&delta, b);
+    U_VecSub(&delta, a);
+    return U_VecLenSq(&delta);
+}
 
 // Normalize a vector.
-void U_VecNormalize(vector_t *vtx);
+static inline void U_VecNormalize(vector_t *vtx) {
+    float lensq = U_VecLenSq(vtx);
+    if (lensq > 0.0f) {
+        lensq = 1.0f / sqrtf(lensq);
+        vtx->x *= lensq;
+        vtx->y *= lensq;
+    }
+}
 
 #endif
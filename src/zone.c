@@ -0,0 +1,333 @@
+#include "log.h"
+#include "system.h"
+#include "zone.h"
+
+#include <string.h>
+
+// Value marking a block header, to catch bad pointers.
+#define ZONEID 0x1d4a
+
+// Smallest piece worth splitting off a free block.
+#define MINFRAGMENT 64
+
+// Round a size up to the alignment of allocations.
+#define ALIGN(_size_) (((_size_) + 7) & ~(size_t) 7)
+
+// A block of the zone, followed by its memory. Blocks cover the whole zone and
+// are linked in address order, circling back to the zone header.
+typedef struct memblock_s {
+    // Size of the block, including this header.
+    size_t size;
+    // Pointer to the memory, or NULL if unowned.
+    void **owner;
+    // Lifetime tag, or PU_FREE if free.
+    uint8_t tag;
+    // Subsystem that allocated the block.
+    uint8_t subsys;
+    // Always ZONEID.
+    uint16_t id;
+    // Neighbouring blocks.
+    struct memblock_s *next;
+    struct memblock_s *prev;
+} __attribute__((aligned(8))) memblock_t;
+
+typedef struct {
+    // Size of the zone, including this header.
+    size_t size;
+    // Head and tail of the block list. Marked as in use so it is never merged.
+    memblock_t blocklist;
+    // Where to start looking for free memory.
+    memblock_t *rover;
+} memzone_t;
+
+static memzone_t *mainzone;
+
+#ifdef ZONE_TRACKING
+
+static const char *subsysnames[NUMZSUBSYS] = {
+    "misc",
+    "map",
+    "texture",
+    "sprite",
+    "actor",
+    "render",
+};
+
+static zsubsysstats_t subsysstats[NUMZSUBSYS];
+// Allocations of each subsystem in the current frame.
+static uint32_t subsysframeallocs[NUMZSUBSYS];
+
+static size_t usedbytes;
+static size_t peakbytes;
+static uint32_t frameallocs;
+static uint32_t lastframeallocs;
+
+// Count an allocation by a subsystem, using size bytes of a block of
+// blocksize bytes. Pooled objects have no block of their own.
+static void TrackAlloc(zsubsys_t subsys, size_t size, size_t blocksize) {
+    usedbytes += blocksize;
+    if (usedbytes > peakbytes) {
+        peakbytes = usedbytes;
+    }
+    zsubsysstats_t *stats = &subsysstats[subsys];
+    stats->live += size;
+    if (stats->live > stats->peak) {
+        stats->peak = stats->live;
+    }
+    ++stats->allocs;
+    ++subsysframeallocs[subsys];
+    ++frameallocs;
+}
+
+// Count a free by a subsystem, as with TrackAlloc.
+static void TrackFree(zsubsys_t subsys, size_t size, size_t blocksize) {
+    usedbytes -= blocksize;
+    subsysstats[subsys].live -= size;
+    ++subsysstats[subsys].frees;
+}
+
+#define TRACKALLOC(_subsys_, _size_, _blocksize_) TrackAlloc(_subsys_, _size_, _blocksize_)
+#define TRACKFREE(_subsys_, _size_, _blocksize_)  TrackFree(_subsys_, _size_, _blocksize_)
+
+#else
+
+#define TRACKALLOC(_subsys_, _size_, _blocksize_) ((void) 0)
+#define TRACKFREE(_subsys_, _size_, _blocksize_)  ((void) 0)
+
+#endif
+
+void Z_Init(void) {
+    mainzone = playdate->system->realloc(NULL, ZONESIZE);
+    if (mainzone == NULL) {
+        Y_Error("Z_Init: Failed to allocate %u bytes", (unsigned) ZONESIZE);
+    }
+    mainzone->size = ZONESIZE;
+    // Start with one free block covering the zone.
+    memblock_t *block = (memblock_t *) ((uint8_t *) mainzone + ALIGN(sizeof(memzone_t)));
+    mainzone->blocklist.next = mainzone->blocklist.prev = block;
+    mainzone->blocklist.owner = (void **) mainzone;
+    mainzone->blocklist.tag = PU_STATIC;
+    mainzone->rover = block;
+    block->prev = block->next = &mainzone->blocklist;
+    block->tag = PU_FREE;
+    block->owner = NULL;
+    block->id = ZONEID;
+    block->size = ZONESIZE - ALIGN(sizeof(memzone_t));
+}
+
+// Get the block header of memory.
+static memblock_t *GetBlock(void *ptr, const char *func) {
+    memblock_t *block = (memblock_t *) ((uint8_t *) ptr - sizeof(memblock_t));
+    if (block->id != ZONEID || block->tag == PU_FREE) {
+        Y_Error("%s: Pointer was not allocated by Z_Malloc", func);
+    }
+    return block;
+}
+
+// Free a block and merge it with free neighbours. Returns the merged block.
+static memblock_t *FreeBlock(memblock_t *block) {
+    TRACKFREE(block->subsys, block->size - sizeof(memblock_t), block->size);
+    if (block->owner != NULL) {
+        *block->owner = NULL;
+    }
+    block->tag = PU_FREE;
+    block->owner = NULL;
+    memblock_t *other = block->prev;
+    if (other->tag == PU_FREE) {
+        // Merge with the previous block.
+        other->size += block->size;
+        other->next = block->next;
+        other->next->prev = other;
+        if (block == mainzone->rover) {
+            mainzone->rover = other;
+        }
+        block = other;
+    }
+    other = block->next;
+    if (other->tag == PU_FREE) {
+        // Merge the next block into this one.
+        block->size += other->size;
+        block->next = other->next;
+        block->next->prev = block;
+        if (other == mainzone->rover) {
+            mainzone->rover = block;
+        }
+    }
+    return block;
+}
+
+void *Z_Malloc(size_t size, ztag_t tag, void **owner, zsubsys_t subsys) {
+    if (tag == PU_FREE || tag >= NUMTAGS || subsys >= NUMZSUBSYS) {
+        Y_Error("Z_Malloc: Bad tag %d or subsystem %d", tag, subsys);
+    }
+    if (tag >= PU_PURGELEVEL && owner == NULL) {
+        Y_Error("Z_Malloc: Purgeable memory needs an owner");
+    }
+    size = ALIGN(size) + sizeof(memblock_t);
+    // Scan from the rover for a run of free or purgeable blocks big enough,
+    // starting at a free block just before the rover if there is one.
+    memblock_t *base = mainzone->rover;
+    if (base->prev->tag == PU_FREE) {
+        base = base->prev;
+    }
+    memblock_t *rover = base;
+    memblock_t *start = base->prev;
+    do {
+        if (rover == start) {
+            // Went all the way around.
+            Y_Error("Z_Malloc: Failed on allocation of %u bytes", (unsigned) size);
+        }
+        if (rover->tag != PU_FREE) {
+            if (rover->tag < PU_PURGELEVEL) {
+                // Can't use this block, so start over after it.
+                base = rover = rover->next;
+            } else {
+                // Purge the block, merging it with the run so far.
+                base = base->prev;
+                FreeBlock(rover);
+                base = base->next;
+                rover = base->next;
+            }
+        } else {
+            rover = rover->next;
+        }
+    } while (base->tag != PU_FREE || base->size < size);
+    // Split off the rest if it is big enough to be useful.
+    size_t extra = base->size - size;
+    if (extra > MINFRAGMENT) {
+        memblock_t *newblock = (memblock_t *) ((uint8_t *) base + size);
+        newblock->size = extra;
+        newblock->tag = PU_FREE;
+        newblock->owner = NULL;
+        newblock->id = ZONEID;
+        newblock->prev = base;
+        newblock->next = base->next;
+        newblock->next->prev = newblock;
+        base->next = newblock;
+        base->size = size;
+    }
+    base->tag = tag;
+    base->subsys = subsys;
+    base->owner = owner;
+    base->id = ZONEID;
+    TRACKALLOC(subsys, base->size - sizeof(memblock_t), base->size);
+    void *ptr = (uint8_t *) base + sizeof(memblock_t);
+    if (owner != NULL) {
+        *owner = ptr;
+    }
+    // Look for free memory after this block next time.
+    mainzone->rover = base->next;
+    return ptr;
+}
+
+void Z_Free(void *ptr) {
+    if (ptr != NULL) {
+        FreeBlock(GetBlock(ptr, "Z_Free"));
+    }
+}
+
+void Z_FreeTags(ztag_t low, ztag_t high) {
+    memblock_t *block = mainzone->blocklist.next;
+    while (block != &mainzone->blocklist) {
+        memblock_t *next = block->next;
+        if (block->tag >= low && block->tag <= high && block->tag != PU_FREE) {
+            // The next block may be merged away, so carry on after the result.
+            next = FreeBlock(block)->next;
+        }
+        block = next;
+    }
+}
+
+void Z_ChangeTag(void *ptr, ztag_t tag) {
+    memblock_t *block = GetBlock(ptr, "Z_ChangeTag");
+    if (tag >= PU_PURGELEVEL && block->owner == NULL) {
+        Y_Error("Z_ChangeTag: Purgeable memory needs an owner");
+    }
+    block->tag = tag;
+}
+
+size_t Z_FreeMemory(void) {
+    size_t free = 0;
+    for (memblock_t *block = mainzone->blocklist.next; block != &mainzone->blocklist; block = block->next) {
+        if (block->tag == PU_FREE || block->tag >= PU_PURGELEVEL) {
+            free += block->size;
+        }
+    }
+    return free;
+}
+
+void Z_EndFrame(void) {
+#ifdef ZONE_TRACKING
+    for (int i = 0; i < NUMZSUBSYS; i++) {
+        subsysstats[i].frameallocs = subsysframeallocs[i];
+        subsysframeallocs[i] = 0;
+    }
+    lastframeallocs = frameallocs;
+    frameallocs = 0;
+#endif
+}
+
+#ifdef ZONE_TRACKING
+
+void Z_GetSubsysStats(zsubsys_t subsys, zsubsysstats_t *stats) {
+    *stats = subsysstats[subsys];
+}
+
+void Z_GetStats(zstats_t *stats) {
+    stats->used = usedbytes;
+    stats->peak = peakbytes;
+    stats->largestfree = 0;
+    stats->freeblocks = 0;
+    for (memblock_t *block = mainzone->blocklist.next; block != &mainzone->blocklist; block = block->next) {
+        if (block->tag == PU_FREE) {
+            ++stats->freeblocks;
+            if (block->size > stats->largestfree) {
+                stats->largestfree = block->size;
+            }
+        }
+    }
+    stats->frameallocs = lastframeallocs;
+}
+
+const char *Z_SubsysName(zsubsys_t subsys) {
+    return subsysnames[subsys];
+}
+
+void Z_Dump(void) {
+    zstats_t stats;
+    Z_GetStats(&stats);
+    playdate->system->logToConsole("zone: %u of %u bytes used, peak %u, %u free blocks, largest %u, %u allocs last frame",
+        (unsigned) stats.used, (unsigned) mainzone->size, (unsigned) stats.peak,
+        (unsigned) stats.freeblocks, (unsigned) stats.largestfree, (unsigned) stats.frameallocs);
+    for (int i = 0; i < NUMZSUBSYS; i++) {
+        const zsubsysstats_t *s = &subsysstats[i];
+        playdate->system->logToConsole("  %-8s live %8u peak %8u allocs %6u frees %6u last frame %u",
+            subsysnames[i], (unsigned) s->live, (unsigned) s->peak,
+            (unsigned) s->allocs, (unsigned) s->frees, (unsigned) s->frameallocs);
+    }
+}
+
+#endif
+
+void *Z_PoolAlloc(zpool_t *pool) {
+    if (pool->free == NULL) {
+        // Carve a new chunk of objects and chain them onto the free list.
+        uint8_t *chunk = Z_Malloc(pool->size * ZPOOLCHUNK, PU_STATIC, NULL, pool->subsys);
+        for (size_t i = 0; i < ZPOOLCHUNK; i++) {
+            void *obj = &chunk[pool->size * i];
+            *(void **) obj = pool->free;
+            pool->free = obj;
+        }
+    }
+    void *obj = pool->free;
+    pool->free = *(void **) obj;
+    // Count objects as allocations, but their memory is already counted.
+    TRACKALLOC(pool->subsys, 0, 0);
+    return obj;
+}
+
+void Z_PoolFree(zpool_t *pool, void *ptr) {
+    *(void **) ptr = pool->free;
+    pool->free = ptr;
+    TRACKFREE(pool->subsys, 0, 0);
+}
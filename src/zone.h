@@ -0,0 +1,135 @@
+#ifndef BRUTE_Z_ZONE_H
+#define BRUTE_Z_ZONE_H
+
+/**
+ * Zone memory allocator. The engine allocates from one block of memory taken
+ * from the system at startup, so that its allocations do not fragment the heap
+ * shared with Lua. Every allocation has a tag describing its lifetime, and all
+ * allocations with a tag can be freed at once. Cache allocations may be purged
+ * by any allocation that runs out of room, in which case their owner's pointer
+ * to them is set to NULL.
+ *
+ * When ZONE_TRACKING is defined, the zone also counts the memory used by each
+ * subsystem, how often it allocates, and the most it has used at once.
+ */
+
+#include "types.h"
+
+// Size of the game's heap in bytes, passed in by the Makefile.
+#ifndef HEAP_SIZE
+#define HEAP_SIZE 8388208
+#endif
+
+// Size of the zone in bytes: three eighths of the heap, leaving the rest to
+// Lua and the system.
+#ifndef ZONESIZE
+#define ZONESIZE ((HEAP_SIZE / 8 * 3) & ~7)
+#endif
+
+// Lifetime tags of allocations, in order of how long they live. Allocations
+// tagged at or above PU_PURGELEVEL may be purged.
+typedef enum {
+    PU_FREE,    // Not allocated.
+    PU_STATIC,  // Lives until freed.
+    PU_LEVEL,   // Lives as long as the map it belongs to.
+    PU_CACHE,   // Can be purged whenever memory is needed.
+    NUMTAGS,
+} ztag_t;
+
+#define PU_PURGELEVEL PU_CACHE
+
+// Subsystems that allocate memory, for tracking.
+typedef enum {
+    ZS_MISC,    // Anything else.
+    ZS_MAP,     // Maps and map loaders.
+    ZS_TEXTURE, // Texture records and data.
+    ZS_SPRITE,  // Sprites.
+    ZS_ACTOR,   // Actors.
+    ZS_RENDER,  // Renderer working memory.
+    NUMZSUBSYS,
+} zsubsys_t;
+
+// Take the zone from the system. Call this before allocating.
+void Z_Init(void);
+
+// Allocate memory with a tag for a subsystem. The owner, if not NULL, is set
+// to the memory, and is set to NULL if the memory is freed or purged. Cache
+// allocations must have an owner. Memory is aligned to 8 bytes.
+void *Z_Malloc(size_t size, ztag_t tag, void **owner, zsubsys_t subsys);
+
+// Free memory allocated by Z_Malloc. NULL is ignored.
+void Z_Free(void *ptr);
+
+// Free all memory with tags from low to high, inclusive.
+void Z_FreeTags(ztag_t low, ztag_t high);
+
+// Change the tag of memory, such as to keep a cache allocation from being
+// purged while in use.
+void Z_ChangeTag(void *ptr, ztag_t tag);
+
+// Get the number of bytes that are free or purgeable.
+size_t Z_FreeMemory(void);
+
+// Finish a frame, starting new per-frame allocation counts.
+void Z_EndFrame(void);
+
+#ifdef ZONE_TRACKING
+
+// Memory statistics of a subsystem.
+typedef struct {
+    size_t   live;        // Number of bytes allocated.
+    size_t   peak;        // Most bytes allocated at once.
+    uint32_t allocs;      // Number of allocations.
+    uint32_t frees;       // Number of frees, including purges.
+    uint32_t frameallocs; // Number of allocations in the last frame.
+} zsubsysstats_t;
+
+// Memory statistics of the whole zone.
+typedef struct {
+    size_t   used;        // Number of bytes used, including block headers.
+    size_t   peak;        // Most bytes used at once.
+    size_t   largestfree; // Size of the largest free block.
+    uint32_t freeblocks;  // Number of free blocks.
+    uint32_t frameallocs; // Number of allocations in the last frame.
+} zstats_t;
+
+// Get the statistics of a subsystem.
+void Z_GetSubsysStats(zsubsys_t subsys, zsubsysstats_t *stats);
+
+// Get the statistics of the zone.
+void Z_GetStats(zstats_t *stats);
+
+// Get the name of a subsystem.
+const char *Z_SubsysName(zsubsys_t subsys);
+
+// Log the statistics of the zone and each subsystem.
+void Z_Dump(void);
+
+#endif
+
+// Number of objects allocated at once when a pool runs out.
+#define ZPOOLCHUNK 16
+
+// A pool of objects of one size, for small objects that are allocated and
+// freed often. Freed objects go on a free list and are reused without going
+// through the zone. Pool memory is never returned to the zone.
+typedef struct {
+    // Size of each object.
+    size_t size;
+    // The subsystem the objects belong to.
+    zsubsys_t subsys;
+    // The first free object. Each free object points to the next.
+    void *free;
+} zpool_t;
+
+// Make a pool for objects of a size. Pools can also be initialized statically.
+// Live bytes of the subsystem include the free objects in the pool.
+#define ZPOOL(_size_, _subsys_) { (((_size_) + 7) & ~(size_t) 7), (_subsys_), NULL }
+
+// Allocate an object from a pool.
+void *Z_PoolAlloc(zpool_t *pool);
+
+// Return an object to its pool.
+void Z_PoolFree(zpool_t *pool, void *ptr);
+
+#endif
@@ -1,17 +1,21 @@
 #!/usr/bin/env python3
 
 # This script converts maps into Brute's binary formats. Maps must be in PWADs and in UDMF format.
-# This requires the parsimonious package to run. (TODO use python environments to simplify this)
-
-# TODO convert sectors into sets of convex shapes or otherwise throw error on concave shapes
+# This requires the parsimonious and numpy packages to run. (TODO use python environments to simplify this)
+# Conversion is incremental: inputs whose contents haven't changed since the last run are skipped.
 
+import concurrent.futures
+import hashlib
 import io
+import json
+import math
 import os
 import re
 import shutil
 import struct
 import sys
 
+import numpy as np
 from PIL import Image
 
 UNQUOTE = re.compile(r'\\(.)')
@@ -24,6 +28,37 @@ PALETTE_CONV = (
     0xff
 )
 
+# Lookup table from color to shade, or -1 if the color is not in the palette.
+SHADE_LUT = np.full(256, -1, dtype=np.int16)
+SHADE_LUT[list(PALETTE_CONV)] = np.arange(len(PALETTE_CONV))
+
+# Name of the file in the output folder recording what each input produced.
+MANIFEST_NAME = '.manifest.json'
+
+# Map file format version.
+MAP_VERSION = 3
+
+# Tags and names of the sections in a packed map file. The sections the engine
+# uses in place come first, so they sit next to the walls in memory.
+MAP_SECTIONS = (
+    (b'VRTX', 'vertices'),
+    (b'EDGE', 'edges'),
+    (b'SECT', 'sectors'),
+    (b'WALL', 'walls'),
+    (b'WCLC', 'wallcalcs'),
+    (b'BNDS', 'bounds'),
+    (b'PTCH', 'patches'),
+    (b'FLAT', 'flats'),
+)
+
+# Light level of sectors that don't specify one. UDMF says 160, but maps made
+# before sectors had light levels expect to be drawn at full brightness.
+DEFAULT_LIGHT = 255
+
+# FNV-1a parameters for the map checksum.
+CHECKSUM_BASIS = 2166136261
+CHECKSUM_PRIME = 16777619
+
 from parsimonious import Grammar, NodeVisitor
 
 udmf_grammar = Grammar(
@@ -91,20 +126,259 @@ class UdmfVisitor(NodeVisitor):
     def generic_visit(self, node, visited_children):
         return visited_children or node
 
-if len(sys.argv) != 4:
-    print('usage: {} <input PWAD> <output folder>'.format(sys.argv[0]), file=sys.stderr)
-    exit(1)
+def f32(x):
+    # Round to single precision, as the engine calculates with floats.
+    return struct.unpack('<f', struct.pack('<f', x))[0]
+
+def calc_walls(vertices, wall_set):
+    # Precalculate the wall data the engine would otherwise calculate on load.
+    # Each step is rounded as the engine would round it.
+    wallcalcs = []
+    for i, wall in enumerate(wall_set):
+        x1, y1 = vertices[wall[0]]
+        x2, y2 = vertices[wall_set[(i+1)%len(wall_set)][0]]
+        dx = f32(x2 - x1)
+        dy = f32(y2 - y1)
+        assert dx != 0 or dy != 0, 'zero length wall'
+        lensq = f32(f32(dx * dx) + f32(dy * dy))
+        inv = f32(1 / f32(math.sqrt(lensq)))
+        nx = f32(dy * inv)
+        ny = f32(-dx * inv)
+        length = f32(math.sqrt(lensq))
+        c = -f32(f32(nx * x1) + f32(ny * y1))
+        wallcalcs.append((dx, dy, nx, ny, length, c))
+    return wallcalcs
+
+# The engine requires convex sectors, so concave sectors are split into convex
+# pieces joined by invisible portals. The polygon is triangulated by ear
+# clipping, then triangles are merged back together across every diagonal
+# whose removal keeps the piece convex (Hertel-Mehlhorn). Longer diagonals are
+# removed first, as they tend to join larger areas. The result has at most four
+# times the optimal number of pieces, and usually far fewer.
+
+def cross(o, a, b):
+    return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0])
+
+def winding(vertices, loop):
+    # Sign of twice the signed area of the polygon.
+    area = 0
+    for i, v in enumerate(loop):
+        x1, y1 = vertices[v]
+        x2, y2 = vertices[loop[(i+1)%len(loop)]]
+        area += x1 * y2 - x2 * y1
+    return 1 if area > 0 else -1
+
+def turn(vertices, loop, i, sign):
+    # Positive for convex corners, negative for reflex, zero if collinear.
+    return sign * cross(vertices[loop[i-1]], vertices[loop[i]], vertices[loop[(i+1)%len(loop)]])
+
+def is_convex(vertices, loop, sign):
+    return all(turn(vertices, loop, i, sign) >= 0 for i in range(len(loop)))
+
+def in_triangle(p, a, b, c, sign):
+    # Points on the boundary count as inside, so no ear touches another vertex.
+    return (sign * cross(a, b, p) >= 0 and
+            sign * cross(b, c, p) >= 0 and
+            sign * cross(c, a, p) >= 0)
+
+def triangulate(vertices, loop, sign):
+    remaining = list(loop)
+    triangles = []
+    while len(remaining) > 3:
+        for i in range(len(remaining)):
+            if turn(vertices, remaining, i, sign) <= 0:
+                continue
+            a, b, c = remaining[i-1], remaining[i], remaining[(i+1)%len(remaining)]
+            points = (vertices[a], vertices[b], vertices[c])
+            if any(in_triangle(vertices[v], *points, sign)
+                    for v in remaining if vertices[v] not in points):
+                continue
+            triangles.append([a, b, c])
+            del remaining[i]
+            break
+        else:
+            raise ValueError('sector polygon is self-intersecting')
+    triangles.append(remaining)
+    return triangles
+
+def merge_pieces(vertices, pieces, sign):
+    # Repeatedly merge two pieces across their shared diagonal if the result
+    # is convex, trying the longest diagonals first.
+    def diagonals():
+        edges = {}
+        for p, piece in enumerate(pieces):
+            if piece is None:
+                continue
+            for i, a in enumerate(piece):
+                edges[(a, piece[(i+1)%len(piece)])] = p
+        result = []
+        for (a, b), p in edges.items():
+            q = edges.get((b, a))
+            if q is not None and p < q:
+                (x1, y1), (x2, y2) = vertices[a], vertices[b]
+                result.append(((x2 - x1) ** 2 + (y2 - y1) ** 2, a, b, p, q))
+        result.sort(reverse=True)
+        return result
+    merged = True
+    while merged:
+        merged = False
+        for _, a, b, p, q in diagonals():
+            # Piece p has edge a -> b, and piece q has edge b -> a.
+            first, second = pieces[p], pieces[q]
+            i = first.index(b)
+            first = first[i:] + first[:i]
+            j = second.index(a)
+            second = second[j:] + second[:j]
+            candidate = first + second[1:-1]
+            if is_convex(vertices, candidate, sign):
+                pieces[p] = candidate
+                pieces[q] = None
+                merged = True
+                break
+    return [piece for piece in pieces if piece is not None]
+
+def split_sector(vertices, loop):
+    # Returns a list of convex loops of vertex indices that cover the polygon.
+    sign = winding(vertices, loop)
+    if is_convex(vertices, loop, sign):
+        return [loop]
+    # Collinear vertices can't be ear tips, so leave them out and restore them
+    # on the boundary edges afterwards.
+    corners = [v for i, v in enumerate(loop) if turn(vertices, loop, i, sign) != 0]
+    pieces = merge_pieces(vertices, triangulate(vertices, corners, sign), sign)
+    between = {}
+    for i, v in enumerate(corners):
+        nxt = corners[(i+1)%len(corners)]
+        k = loop.index(v)
+        run = []
+        while loop[(k+1)%len(loop)] != nxt:
+            k = (k + 1) % len(loop)
+            run.append(loop[k])
+        between[(v, nxt)] = run
+    result = []
+    for piece in pieces:
+        full = []
+        for i, v in enumerate(piece):
+            full.append(v)
+            full.extend(between.get((v, piece[(i+1)%len(piece)]), []))
+        result.append(full)
+    return result
+
+def split_sectors(vertices, walls):
+    # Split each sector's ordered walls into convex pieces. Returns, for each
+    # piece, its original sector index and its walls with portals renumbered.
+    # Walls added between pieces are untextured portals.
+    pieces = []
+    owner = {}
+    for j, wall_set in enumerate(walls):
+        attributes = {(wall[0], wall[1]): wall for wall in wall_set}
+        loop = [wall[0] for wall in wall_set]
+        for piece in split_sector(vertices, loop):
+            for i, v in enumerate(piece):
+                owner[(v, piece[(i+1)%len(piece)])] = len(pieces)
+            pieces.append((j, piece, attributes))
+    result = []
+    for p, (j, piece, attributes) in enumerate(pieces):
+        new_walls = []
+        for i, v1 in enumerate(piece):
+            v2 = piece[(i+1)%len(piece)]
+            wall = attributes.get((v1, v2))
+            if wall is None:
+                # Invisible portal between two pieces of the same sector.
+                new_walls.append((v1, v2, owner[(v2, v1)], 0, 0, 0, 0, 0))
+            elif wall[2] == j:
+                new_walls.append((v1, v2, p, *wall[3:]))
+            else:
+                new_walls.append((v1, v2, owner[(v2, v1)], *wall[3:]))
+        result.append((j, new_walls))
+    return result
 
-def handle_udmf(content):
+# Sectors can be renumbered so that neighbours in the portal graph are stored
+# near each other, along with their walls and vertices. This keeps portal walks
+# in the renderer and the collision search within fewer cache lines.
+
+def sector_neighbours(pieces):
+    return [sorted({wall[2] for wall in wall_set if wall[2] != p})
+            for p, (_, wall_set) in enumerate(pieces)]
+
+def bfs_order(neighbours):
+    # Breadth-first from sector 0, so that it stays the first sector.
+    order = []
+    seen = [False] * len(neighbours)
+    for root in range(len(neighbours)):
+        if seen[root]:
+            continue
+        seen[root] = True
+        queue = [root]
+        for p in queue:
+            order.append(p)
+            for q in neighbours[p]:
+                if not seen[q]:
+                    seen[q] = True
+                    queue.append(q)
+    return order
+
+def rcm_order(neighbours):
+    # Reverse Cuthill-McKee: breadth-first from a lowest degree sector,
+    # visiting neighbours by increasing degree, then reversed.
+    order = []
+    seen = [False] * len(neighbours)
+    degree = lambda p: len(neighbours[p])
+    for root in sorted(range(len(neighbours)), key=degree):
+        if seen[root]:
+            continue
+        seen[root] = True
+        queue = [root]
+        for p in queue:
+            order.append(p)
+            for q in sorted(neighbours[p], key=degree):
+                if not seen[q]:
+                    seen[q] = True
+                    queue.append(q)
+    order.reverse()
+    return order
+
+REORDER_METHODS = {
+    'bfs': bfs_order,
+    'rcm': rcm_order,
+}
+
+def portal_span(pieces):
+    # Mean distance between the indices of sectors joined by a portal, as a
+    # measure of locality.
+    spans = [abs(wall[2] - p) for p, (_, wall_set) in enumerate(pieces)
+             for wall in wall_set if wall[2] != p]
+    return sum(spans) / len(spans) if spans else 0
+
+def reorder_sectors(vertices, pieces, method):
+    # Returns the renumbered vertices and sectors.
+    order = REORDER_METHODS[method](sector_neighbours(pieces))
+    newindex = [0] * len(order)
+    for i, p in enumerate(order):
+        newindex[p] = i
+    # Vertices are numbered by first use.
+    vertexindex = {}
+    for p in order:
+        for wall in pieces[p][1]:
+            vertexindex.setdefault(wall[0], len(vertexindex))
+    newvertices = [None] * len(vertexindex)
+    for old, new in vertexindex.items():
+        newvertices[new] = vertices[old]
+    newpieces = []
+    for p in order:
+        j, wall_set = pieces[p]
+        newpieces.append((j, [(vertexindex[wall[0]], vertexindex[wall[1]], newindex[wall[2]], *wall[3:])
+                              for wall in wall_set]))
+    return newvertices, newpieces
+
+def handle_udmf(content, reorder):
     udmf = content.decode()
     # Parse UDMF.
     mapdata = UdmfVisitor().visit(udmf_grammar.parse(udmf))
-    # Write vertices.
-    out_vertices = bytearray()
+    # Get vertices.
+    vertices = []
     for vertex in mapdata['vertex']:
-        x = round(vertex['x'])
-        y = round(vertex['y'])
-        out_vertices.extend(struct.pack('<hh', x, y))
+        vertices.append((round(vertex['x']), round(vertex['y'])))
     # Collection of patch names to use.
     patchnames = {}
     def get_patch_id(name):
@@ -152,19 +426,45 @@ def handle_udmf(content):
         while len(new_wall_set) < len(wall_set):
             new_wall_set.append([wall for wall in wall_set if wall[0] == new_wall_set[-1][1]][0])
         walls[i] = new_wall_set
-    # Write walls and sectors.
+    # Split concave sectors into convex pieces.
+    pieces = split_sectors(vertices, walls)
+    span = portal_span(pieces)
+    if reorder is not None:
+        vertices, pieces = reorder_sectors(vertices, pieces, reorder)
+    # Write vertices.
+    out_vertices = bytearray()
+    for x, y in vertices:
+        # Stored as floats so the engine can use them in place.
+        out_vertices.extend(struct.pack('<ff', x, y))
+    # Write walls and sectors, with their precalculated data.
     out_walls = bytearray()
     out_sectors = bytearray()
+    out_wallcalcs = bytearray()
+    out_bounds = bytearray()
+    edge_a = []
+    edge_b = []
+    edge_c = []
     wall_index = 0
-    for j, wall_set in enumerate(walls):
+    for j, wall_set in pieces:
         mapsector = mapdata['sector'][j]
-        out_sectors.extend(struct.pack('<HHhhBB',
+        assert len(wall_set) >= 3, 'sector {} is not a polygon'.format(j)
+        assert mapsector.get('heightceiling', 0) > mapsector.get('heightfloor', 0)
+        for dx, dy, nx, ny, length, c in calc_walls(vertices, wall_set):
+            out_wallcalcs.extend(struct.pack('<fffff', dx, dy, nx, ny, length))
+            edge_a.append(nx)
+            edge_b.append(ny)
+            edge_c.append(c)
+        xs = [vertices[wall[0]][0] for wall in wall_set]
+        ys = [vertices[wall[0]][1] for wall in wall_set]
+        out_bounds.extend(struct.pack('<ffff', min(xs), min(ys), max(xs), max(ys)))
+        out_sectors.extend(struct.pack('<HHhhBBB',
             len(wall_set),
             wall_index,
             mapsector.get('heightfloor', 0),
             mapsector.get('heightceiling', 0),
             get_flat_id(mapsector['texturefloor']),
             get_flat_id(mapsector['textureceiling']),
+            max(0, min(255, mapsector.get('lightlevel', DEFAULT_LIGHT))),
         ))
         for i, wall in enumerate(wall_set):
             assert wall[1] == wall_set[(i+1)%len(wall_set)][0]
@@ -193,42 +493,104 @@ def handle_udmf(content):
     #         print(mapdata['vertex'][wall[0]]['y'], end='')
     #         print(r'\right)', end='')
     #     print(r'\right)')
-    # Commit to files.
+    # Collect the sections.
     result = {}
     result['vertices'] = out_vertices
     result['sectors'] = out_sectors
     result['walls'] = out_walls
     result['patches'] = out_patches
     result['flats'] = out_flats
+    result['wallcalcs'] = out_wallcalcs
+    # Line equations are stored as all a coefficients, then all b, then all c.
+    result['edges'] = struct.pack('<{}f'.format(3 * len(edge_a)), *edge_a, *edge_b, *edge_c)
+    result['bounds'] = out_bounds
+    # Statistics to report.
+    portals = sum(1 for p, (_, wall_set) in enumerate(pieces) for wall in wall_set if wall[2] != p)
+    result['stats'] = (len(walls), len(pieces), portals, sum(len(w) for w in walls), wall_index,
+                       span, portal_span(pieces))
     return result
 
+def map_checksum(data):
+    checksum = CHECKSUM_BASIS
+    for byte in data:
+        checksum = ((checksum ^ byte) * CHECKSUM_PRIME) & 0xffffffff
+    return checksum
+
+def pack_map(mapdata) -> bytes:
+    # Header, then section table, then each section aligned to 4 bytes. The
+    # checksum covers everything after the section table, and lets the engine
+    # trust the precalculated data and skip validation.
+    header_size = 12 + 12 * len(MAP_SECTIONS)
+    table = bytearray()
+    body = bytearray()
+    for tag, key in MAP_SECTIONS:
+        table.extend(struct.pack('<4sII', tag, header_size + len(body), len(mapdata[key])))
+        body.extend(mapdata[key])
+        body.extend(bytes(-len(body) % 4))
+    header = b'BMAP' + struct.pack('<HHI', MAP_VERSION, len(MAP_SECTIONS), map_checksum(body))
+    return header + table + body
+
+def shade_gap(shades, filepath, messages):
+    # Textures are stored with 4 bits per texel, so each can use 16 of the 17
+    # shades. The shade gap is the one left out, and the engine adds one to
+    # texels at or above it. Leave out a shade the texture does not use,
+    # preferring the extremes. A texture that uses all 17 shades leaves out
+    # its least used one, drawn as a neighbouring shade instead, with a warning.
+    counts = np.bincount(shades.ravel(), minlength=17)
+    for gap in (16, 0, *range(1, 16)):
+        if counts[gap] == 0:
+            return gap
+    gap = int(np.argmin(counts))
+    messages.append('warning: {}: uses all 17 shades, {} of {} texels shown as shade {} instead of {}'.format(
+        filepath, counts[gap], shades.size, gap_neighbour(gap), gap))
+    return gap
+
+def gap_neighbour(gap):
+    # The shade drawn in place of the left out one.
+    return gap - 1 if gap > 0 else 1
+
+def pack_nibbles(shades, gap):
+    values = shades.astype(np.int16).ravel()
+    values[values == gap] = gap_neighbour(gap)
+    values = (values - (values > gap)).astype(np.uint8)
+    if len(values) % 2:
+        values = np.append(values, np.uint8(0))
+    return (values[0::2] | (values[1::2] << 4)).tobytes()
+
+def to_shades(colors, filepath, used=True):
+    # Only the colors selected by used must be in the palette.
+    shades = SHADE_LUT[colors]
+    if (shades[used] < 0).any():
+        raise ValueError('{}: color not in palette'.format(filepath))
+    return shades.astype(np.uint8)
+
 def read_image(filepath):
-    img = Image.open(filepath)
-    width, height = img.size
-    result = bytearray(width * height)
-    for y in range(height):
-        for x in range(width):
-            result[(y * width) + x] = PALETTE_CONV.index(img.getpixel((x, y)))
-    return width, height, result
-
-def write_patch(filepath) -> bytes:
-    width, height, pixels = read_image(filepath)
+    # Returns an array of shades indexed by [y, x].
+    return to_shades(np.asarray(Image.open(filepath)), filepath)
+
+def write_patch(filepath, messages) -> bytes:
+    pixels = read_image(filepath)
+    height, width = pixels.shape
     assert width >= 1 and width < 65536
     assert height >= 1 and height < 65536
     assert (width & (width - 1)) == 0
     assert (height & (height - 1)) == 0
-    result = bytearray([((height.bit_length() - 1) << 4) | (width.bit_length() - 1)])
-    for x in range(width):
-        for y in range(height):
-            result.append(pixels[(width * y) + x])
+    # Each column is packed separately so columns start on byte boundaries.
+    columns = pixels.T
+    if height % 2:
+        columns = np.pad(columns, ((0, 0), (0, 1)))
+    gap = shade_gap(pixels, filepath, messages)
+    result = bytearray([((height.bit_length() - 1) << 4) | (width.bit_length() - 1), gap])
+    result.extend(pack_nibbles(columns, gap))
     return result
 
-def write_flat(filepath) -> bytes:
-    width, height, pixels = read_image(filepath)
-    assert width == 64 and height == 64
-    return pixels
+def write_flat(filepath, messages) -> bytes:
+    pixels = read_image(filepath)
+    assert pixels.shape == (64, 64)
+    gap = shade_gap(pixels, filepath, messages)
+    return bytes([gap]) + pack_nibbles(pixels, gap)
 
-def write_sprite(filepath) -> bytes:
+def write_sprite(filepath, messages) -> bytes:
     img = Image.open(filepath)
     # Use the grAb chunk, if present, to get the image offsets.
     offx = 0
@@ -237,115 +599,158 @@ def write_sprite(filepath) -> bytes:
         if chunktype == b'grAb':
             offx, offy = struct.unpack('>ii', data)
     width, height = img.size
+    pixels = np.asarray(img)
+    opaque = pixels[:, :, 1] == 255
+    colors = to_shades(pixels[:, :, 0], filepath, opaque)
     postarrays = []
-    postoffset = None
     for x in range(width):
+        # Find the runs of opaque pixels in this column.
+        edges = np.flatnonzero(np.diff(opaque[:, x].astype(np.int8), prepend=0, append=0))
         posts = []
         lastpoststart = 0
-        for y in range(height):
-            color, alpha = img.getpixel((x, y))
-            if alpha == 255:
-                if postoffset is None:
-                    postoffset = y - lastpoststart
-                    postdata = bytearray()
-                postdata.append(PALETTE_CONV.index(color))
-            elif postoffset is not None:
-                posts.append((postoffset, postdata))
-                postoffset = None
-                lastpoststart = y
-        if postoffset is not None:
-            posts.append((postoffset, postdata))
-            postoffset = None
+        for start, end in zip(edges[0::2], edges[1::2]):
+            posts.append((start - lastpoststart, colors[start:end, x]))
+            lastpoststart = end
         postarrays.append(posts)
+    shades = colors[opaque]
+    gap = shade_gap(shades, filepath, messages)
     result = bytearray()
-    result.extend(struct.pack('<hhHH', offx, offy, width, height))
+    result.extend(struct.pack('<hhHHB', offx, offy, width, height, gap))
     # TODO consider post compression later on?
     chunks = bytearray()
     for postarray in postarrays:
         result.extend(struct.pack('<I', len(chunks)))
         chunk = bytearray()
         for offset, data in postarray:
+            # Length is in texels, while the data is packed.
             chunk.extend(struct.pack('<BB', len(data), offset))
-            chunk.extend(data)
+            chunk.extend(pack_nibbles(data, gap))
         chunk.append(0)
         chunks.extend(chunk)
     result.extend(chunks)
     return result
 
 # Game assets are stored in GZDoom directory format before being converted to
-# custom formats for our engine.
-
-def copy_flats():
-    srcdir = sys.argv[1] + '/flats'
-    dstdir = sys.argv[3] + '/flats'
-    os.makedirs(dstdir, exist_ok=True)
-    for filename in os.listdir(srcdir):
-        # Get output name.
-        name, _ = os.path.splitext(filename)
-        name = name.lower()
-        # Load PNG.
-        with open(dstdir + '/' + name, 'wb') as outfile:
-            outfile.write(write_flat(srcdir + '/' + filename))
-
-def copy_patches():
-    srcdir = sys.argv[1] + '/patches'
-    dstdir = sys.argv[3] + '/patches'
-    os.makedirs(dstdir, exist_ok=True)
-    for filename in os.listdir(srcdir):
-        # Get output name.
-        name, _ = os.path.splitext(filename)
-        name = name.lower()
-        with open(dstdir + '/' + name, 'wb') as outfile:
-            outfile.write(write_patch(srcdir + '/' + filename))
-
-def copy_maps():
-    srcdir = sys.argv[1] + '/maps'
-    dstdir = sys.argv[3] + '/maps'
-    for filename in os.listdir(srcdir):
-        mapname, _ = os.path.splitext(filename)
-        mapname = mapname.lower()
-        # Parse WAD file.
-        with open(srcdir + '/' + filename, 'rb') as wadfile:
-            if wadfile.read(4) != b'PWAD':
-                print('Not a PWAD', file=sys.stderr)
-                exit(1)
-            numlumps, infotableofs = struct.unpack('<ii', wadfile.read(8))
-            for i in range(numlumps):
-                wadfile.seek(infotableofs + 16 * i, io.SEEK_SET)
-                filepos, size = struct.unpack('<ii', wadfile.read(8))
-                name = wadfile.read(8)
-                if 0 in name:
-                    name = name[:name.index(0)]
-                name = name.decode()
-                if name == 'TEXTMAP':
-                    wadfile.seek(filepos, io.SEEK_SET)
-                    mapdata = handle_udmf(wadfile.read(size))
-                    mapdir = dstdir + '/' + mapname
-                    os.makedirs(mapdir, exist_ok=True)
-                    for key in mapdata:
-                        with open(mapdir + '/' + key, 'wb') as file:
-                            file.write(mapdata[key])
-
-def copy_sprites():
-    srcdir = sys.argv[1] + '/sprites'
-    dstdir = sys.argv[3] + '/sprites'
-    os.makedirs(dstdir, exist_ok=True)
-    # Iterate through sprites.
-    for filename in os.listdir(srcdir):
-        # Get output name.
-        name, _ = os.path.splitext(filename)
-        name = name.lower()
-        # Load PNG.
-        sprite = write_sprite(srcdir + '/' + filename)
-        with open(dstdir + '/' + name, 'wb') as file:
-            file.write(sprite)
-
-try:
-    shutil.rmtree(sys.argv[3])
-except FileNotFoundError:
-    pass
-
-copy_sprites()
-copy_flats()
-copy_patches()
-copy_maps()
+# custom formats for our engine. Each input is converted in a worker process,
+# and returns a list of output paths and their contents, and messages to print.
+
+def convert_image(kind, srcpath, reorder):
+    name, _ = os.path.splitext(os.path.basename(srcpath))
+    writer = {'flats': write_flat, 'patches': write_patch, 'sprites': write_sprite}[kind]
+    messages = []
+    data = bytes(writer(srcpath, messages))
+    return [(kind + '/' + name.lower(), data)], messages
+
+def convert_map(kind, srcpath, reorder):
+    mapname, _ = os.path.splitext(os.path.basename(srcpath))
+    mapname = mapname.lower()
+    outputs = []
+    messages = []
+    # Parse WAD file.
+    with open(srcpath, 'rb') as wadfile:
+        if wadfile.read(4) != b'PWAD':
+            raise ValueError('{}: Not a PWAD'.format(srcpath))
+        numlumps, infotableofs = struct.unpack('<ii', wadfile.read(8))
+        for i in range(numlumps):
+            wadfile.seek(infotableofs + 16 * i, io.SEEK_SET)
+            filepos, size = struct.unpack('<ii', wadfile.read(8))
+            name = wadfile.read(8)
+            if 0 in name:
+                name = name[:name.index(0)]
+            name = name.decode()
+            if name == 'TEXTMAP':
+                wadfile.seek(filepos, io.SEEK_SET)
+                mapdata = handle_udmf(wadfile.read(size), reorder)
+                messages.append('{}: {} sectors split into {}, {} portal walls, {} walls grew to {}, '
+                                'mean portal span {:.1f} -> {:.1f}'.format(mapname, *mapdata['stats']))
+                outputs.append(('maps/' + mapname, pack_map(mapdata)))
+    return outputs, messages
+
+CONVERTERS = {
+    'sprites': convert_image,
+    'flats': convert_image,
+    'patches': convert_image,
+    'maps': convert_map,
+}
+
+def input_hash(kind, srcpath, reorder):
+    # Inputs are reconverted if they, the options, or this script change.
+    digest = hashlib.sha256()
+    with open(__file__, 'rb') as file:
+        digest.update(file.read())
+    digest.update('{}\0{}\0'.format(kind, reorder).encode())
+    with open(srcpath, 'rb') as file:
+        digest.update(file.read())
+    return digest.hexdigest()
+
+def load_manifest(outdir):
+    try:
+        with open(os.path.join(outdir, MANIFEST_NAME)) as file:
+            return json.load(file)
+    except (FileNotFoundError, ValueError):
+        return {}
+
+def write_output(outdir, output, data):
+    path = os.path.join(outdir, output)
+    # Older versions of this script wrote some outputs as directories.
+    if os.path.isdir(path):
+        shutil.rmtree(path)
+    with open(path, 'wb') as file:
+        file.write(data)
+
+def remove_outputs(outdir, outputs):
+    for output in outputs:
+        try:
+            os.remove(os.path.join(outdir, output))
+        except FileNotFoundError:
+            pass
+
+def main():
+    # Sector reordering method, from the --reorder=<method> option. One of the
+    # keys of REORDER_METHODS, or None to keep the UDMF order.
+    reorder = None
+    for arg in sys.argv[1:]:
+        if arg.startswith('--reorder='):
+            reorder = arg[len('--reorder='):]
+    args = [arg for arg in sys.argv if not arg.startswith('--')]
+    if len(args) != 4 or reorder not in (None, *REORDER_METHODS):
+        print('usage: {} [--reorder=bfs|rcm] <input PWAD> <output folder>'.format(args[0]), file=sys.stderr)
+        exit(1)
+    srcroot = args[1]
+    outdir = args[3]
+    manifest = load_manifest(outdir)
+    newmanifest = {}
+    jobs = {}
+    with concurrent.futures.ProcessPoolExecutor() as executor:
+        for kind in CONVERTERS:
+            os.makedirs(os.path.join(outdir, kind), exist_ok=True)
+            srcdir = os.path.join(srcroot, kind)
+            for filename in sorted(os.listdir(srcdir)):
+                srcpath = os.path.join(srcdir, filename)
+                source = kind + '/' + filename
+                key = input_hash(kind, srcpath, reorder)
+                entry = manifest.get(source)
+                if (entry is not None and entry['hash'] == key and
+                        all(os.path.exists(os.path.join(outdir, o)) for o in entry['outputs'])):
+                    newmanifest[source] = entry
+                    continue
+                jobs[executor.submit(CONVERTERS[kind], kind, srcpath, reorder)] = (source, key)
+        # Wait for the jobs in the order they were submitted, so that messages
+        # come out in input order.
+        for future, (source, key) in jobs.items():
+            outputs, messages = future.result()
+            for message in messages:
+                print(message)
+            for output, data in outputs:
+                write_output(outdir, output, data)
+            newmanifest[source] = {'hash': key, 'outputs': [output for output, _ in outputs]}
+    # Remove outputs that are no longer produced by any input.
+    produced = {output for entry in newmanifest.values() for output in entry['outputs']}
+    for entry in manifest.values():
+        remove_outputs(outdir, [output for output in entry['outputs'] if output not in produced])
+    with open(os.path.join(outdir, MANIFEST_NAME), 'w') as file:
+        json.dump(newmanifest, file, indent=1, sort_keys=True)
+    print('converted {} of {} inputs'.format(len(jobs), len(newmanifest)))
+
+if __name__ == '__main__':
+    main()